@@ -4,10 +4,52 @@
 #include <vector>
 #include <algorithm>
 #include <random>
-using namespace std;
+#include <string>
+#include <limits>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstring>
+#include <cmath>
+#include <memory>
+#include <queue>
+#include <type_traits>
+#include <map>
+#include <sstream>
+
+// The batch kernels use AVX2 and AVX-512 when the compiler can target them. Other compilers get the scalar kernels only
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define BLACKJACK_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Hand history logs are read back through mmap where it is available
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The table server runs on epoll
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
-// A method to calculate a random value
-auto rng = default_random_engine {};
+using namespace std;
 
 /***********************
  *  I want this project to work initially offline without worrying about tables or
@@ -49,210 +91,7130 @@ auto rng = default_random_engine {};
  * 
  **********************/
 
-// Class used for generating an individual card card
+// Class used for generating an individual card card. Both fields are packed into a single byte
 class Card {
     public:
-        int value; // 1 to 13, Ace to King
-        int suit; // 1 = Clubs, 2 = Spades, 3 = Diamonds, 4 = Hearts
+        unsigned char value : 4; // 1 to 13, Ace to King
+        unsigned char suit : 4; // 1 = Clubs, 2 = Spades, 3 = Diamonds, 4 = Hearts
+
+        // Constructor that will set the value and suit of each card
+        Card (int v, int s) : value(v), suit(s) {} 
+        Card () : value(0), suit(0) {}  // A blank card, for filling fixed size hands
+
+        // Allows the value and suit of a card to be printed using '<<'
+        friend ostream& operator<<(ostream& os, const Card& card) {
+            // Arrays to look up rank and suit names
+            static const char* const ranks[] = { "Ace", "2", "3", "4", "5", "6", "7", "8", "9", "10", "Jack", "Queen", "King" };
+            static const char* const suits[] = { "Clubs", "Spades", "Diamonds", "Hearts" };
+
+            // Check if rank and suit values are within the valid ranges
+            if (card.value < 1 || card.value > 13 || card.suit < 1 || card.suit > 4) {
+                os << "Invalid card! Something went wrong.\n";
+            }
+            else {
+                // Output the formatted card information
+                os << ( card.value == 1 ? "an " : "a ") << ranks[card.value - 1] << " of " << suits[card.suit - 1];
+            }
+
+            return os;
+        }
+};
+
+static_assert(sizeof(Card) == 1, "A card should fit in a single byte");
+
+// The most cards a single hand can hold. Even with eight decks, 21 cards is the most a hand can take
+// before it busts, so one more than that is always enough
+const int MAX_HAND_CARDS = 24;
+
+// A hand of cards kept inline instead of on the heap, so dealing a round never allocates. It has the
+// same methods as a vector<Card> for the ones a hand needs
+class Hand {
+    public:
+        void push_back(const Card& card) { cards[count++] = card; }
+        void pop_back() { count--; }
+        void clear() { count = 0; }
+
+        const Card& operator[](int i) const { return cards[i]; }
+        const Card& back() const { return cards[count - 1]; }
+        int size() const { return count; }
+        bool empty() const { return count == 0; }
+
+        const Card* begin() const { return cards; }
+        const Card* end() const { return cards + count; }
+
+    private:
+        Card cards[MAX_HAND_CARDS];
+        unsigned char count = 0;
+};
+
+// How many points each card value is worth, with Aces counted as 1
+constexpr unsigned char CARD_POINTS[14] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 10, 10, 10 };
+
+// How many cards of each value are left to be dealt. Jacks, Queens and Kings are all counted as tens,
+// since they play the same way
+struct Composition {
+    unsigned short counts[11] = {};     // [points], with Aces at 1. Index 0 is unused
+    int total = 0;
+
+    void add(int points) { counts[points]++; total++; }
+    void remove(int points) { counts[points]--; total--; }
+    void add(const Card& card) { add(CARD_POINTS[card.value]); }
+    void remove(const Card& card) { remove(CARD_POINTS[card.value]); }
+    void add(const Composition& other) {
+        for (int points = 1; points <= 10; points++) { counts[points] += other.counts[points]; }
+        total += other.total;
+    }
+
+    // Packs the counts into three words so a composition can be hashed and compared quickly. The top half
+    // of the last word is left free for the caller to tag the key with
+    struct Key {
+        uint64_t words[3];
+        bool operator==(const Key& other) const {
+            return words[0] == other.words[0] && words[1] == other.words[1] && words[2] == other.words[2];
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            uint64_t h = key.words[0] * 0x9E3779B97F4A7C15ULL;
+            h = (h ^ (h >> 29) ^ key.words[1]) * 0xBF58476D1CE4E5B9ULL;
+            h = (h ^ (h >> 32) ^ key.words[2]) * 0x94D049BB133111EBULL;
+            return h ^ (h >> 31);
+        }
+    };
+
+    Key key(uint32_t tag = 0) const {
+        Key result = { { 0, 0, (uint64_t)tag << 32 } };
+        for (int points = 1; points <= 10; points++) {
+            result.words[(points - 1) / 4] |= (uint64_t)counts[points] << (16 * ((points - 1) % 4));
+        }
+        return result;
+    }
+};
+
+// Steps a SplitMix64 generator. Used to spread one master seed into many well separated seeds
+uint64_t splitMix64(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// The xoshiro256** generator. It is much faster than mt19937_64 with a state of only 32 bytes, and passes
+// the usual statistical tests. It can be handed to anything in <random> or <algorithm> that takes a generator
+class Xoshiro256 {
+    public:
+        using result_type = uint64_t;
+
+        // The state is filled from SplitMix64, so any seed, even 0, gives a good starting state
+        explicit Xoshiro256(uint64_t seed = 0) {
+            for (uint64_t& word : state) { word = splitMix64(seed); }
+        }
+
+        static constexpr uint64_t min() { return 0; }
+        static constexpr uint64_t max() { return UINT64_MAX; }
+
+        uint64_t operator()() {
+            uint64_t result = rotl(state[1] * 5, 7) * 9;
+            uint64_t t = state[1] << 17;
+
+            state[2] ^= state[0];
+            state[3] ^= state[1];
+            state[1] ^= state[2];
+            state[0] ^= state[3];
+            state[2] ^= t;
+            state[3] = rotl(state[3], 45);
+
+            return result;
+        }
+
+    private:
+        static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+        uint64_t state[4];
+};
+
+// Picks a number from 0 to n - 1 with every number equally likely, using Lemire's multiply and shift.
+// Numbers from the biased low end of the product are thrown away, which almost never happens for a shoe
+// sized n, so there is usually no division at all
+template <class Generator>
+uint32_t bounded(Generator& gen, uint32_t n) {
+    uint64_t product = (uint64_t)(uint32_t)(gen() >> 32) * n;
+    uint32_t low = (uint32_t)product;
+
+    if (low < n) {
+        uint32_t threshold = (0u - n) % n;
+        while (low < threshold) {
+            product = (uint64_t)(uint32_t)(gen() >> 32) * n;
+            low = (uint32_t)product;
+        }
+    }
+
+    return product >> 32;
+}
+
+// Class used for holding a boot of cards that is dealt from a read cursor. Dealing a card only moves the
+// cursor forward, and the dealt cards stay where they are until the shoe is reshuffled.
+class Shoe {
+    public:
+        // Builds a shoe holding the given number of standard 52 card decks
+        Shoe(int numDecks = 0) {
+            fill(numDecks);
+            return;
+        }
+
+        // Adds the standard 52 cards to the shoe the given number of times
+        void fill(int numDecks) {
+            cards.reserve(cards.size() + 52 * numDecks);
+
+            for (int d = 0; d < numDecks; d++) {
+                for (int i = 1; i <= 13; i++) {
+                    for (int j = 1; j <= 4; j++) {
+                        cards.push_back(Card(i, j));
+                        left.add(cards.back());
+                    }
+                }
+            }
+
+            return;
+        }
+
+        // Deals the top card. The caller must check that the shoe is not empty
+        const Card& deal() {
+            left.remove(cards[top]);
+            return cards[top++];
+        }
+
+        // The card that would be dealt next
+        const Card& peek() const { return cards[top]; }
+
+        // The last n cards dealt, in the order they were dealt. They stay put until the shoe is reshuffled
+        const Card* dealtCards(int n) const { return cards.data() + top - n; }
+
+        // How many of each card are left to deal, kept up to date as cards are dealt
+        const Composition& composition() const { return left; }
+
+        int remaining() const { return cards.size() - top; }   // Cards left to deal
+        int dealt() const { return top; }                      // Cards dealt since the last reshuffle
+        int size() const { return cards.size(); }              // Every card that belongs to the shoe
+        bool empty() const { return top == (int)cards.size(); }
+
+        // Deals a card picked at random from the ones left. This is one step of a Fisher-Yates shuffle, so a
+        // shoe that is only ever dealt from this way is shuffled lazily, paying only for the cards it deals.
+        // The caller must check that the shoe is not empty
+        template <class Generator>
+        const Card& dealRandom(Generator& gen) {
+            swap(cards[top], cards[top + bounded(gen, remaining())]);
+            return deal();
+        }
+
+        // Shuffles the cards that are left to deal with a Fisher-Yates shuffle
+        template <class Generator>
+        void shuffle(Generator& gen) {
+            for (int i = top; i < (int)cards.size() - 1; i++) {
+                swap(cards[i], cards[i + bounded(gen, cards.size() - i)]);
+            }
+            return;
+        }
+
+        // Returns every dealt card to the shoe without shuffling. The last 'keep' cards dealt are still on the
+        // table, so they are moved to the front and stay dealt. Only the returned cards are touched, so this
+        // costs as much as the cards dealt since the last shuffle
+        void collect(int keep = 0) {
+            for (int i = 0; i < top - keep; i++) { left.add(cards[i]); }
+            rotate(cards.begin(), cards.begin() + (top - keep), cards.begin() + top);
+            top = keep;
+            return;
+        }
+
+        // Returns every dealt card to the shoe and shuffles it in place
+        template <class Generator>
+        void reshuffle(Generator& gen, int keep = 0) {
+            collect(keep);
+            shuffle(gen);
+            return;
+        }
+
+        // Every card in the shoe in the order it is dealt, starting with the ones already dealt
+        const Card* data() const { return cards.data(); }
+
+        // Puts the given cards in the shoe in that order. The first 'dealt' of them count as dealt already, so a
+        // shoe can be put back exactly as it was
+        void load(const Card* order, int count, int dealt = 0) {
+            cards.assign(order, order + count);
+            top = dealt;
+            left = Composition();
+            for (int i = top; i < (int)cards.size(); i++) { left.add(cards[i]); }
+            return;
+        }
+
+        // Adds cards behind the ones left to deal, in the given order
+        void append(const Card* first, int n) {
+            for (int i = 0; i < n; i++) {
+                cards.push_back(first[i]);
+                left.add(first[i]);
+            }
+            return;
+        }
+
+        // Empties the shoe. Its room for cards is kept, so filling it again doesn't reallocate
+        void clear() {
+            cards.clear();
+            top = 0;
+            left = Composition();
+            return;
+        }
+
+        // Drops every dealt card but the last 'keep', once they have been handed on somewhere else. Only the
+        // cards left to deal are moved
+        void release(int keep = 0) {
+            cards.erase(cards.begin(), cards.begin() + (top - keep));
+            top = keep;
+            return;
+        }
+
+    protected:
+
+        vector<Card> cards; // Stores all of the cards in the shoe, dealt or not
+        int top = 0;        // Where the next card will be dealt from
+        Composition left;   // How many of each card are left to deal
+};
+
+// Class used for generating and managing a deck of cards
+class Deck : public Shoe {
+    public:
+        // Generates one of each card and stores the result in a vector
+        Deck() : Shoe(1) {}
+
+        // Generates the given number of decks at once
+        explicit Deck(int numDecks) : Shoe(numDecks) {}
+
+        // Adds the standard 52 cards to a deck
+        void fillDeck() {
+            fill(1);
+            return;
+        }
+
+        // Transfers the top card from the deck to a given vector
+        void transferCard(vector<Card> &destination) {
+            if (empty()) {
+                cout << "Deck is empty! Cannot transfer a card." << endl;
+                return;
+            } // Check that our deck is not empty
+
+            destination.push_back(deal());     // Transfer the top card to the destination
+
+            return;
+        }
+
+        // Displays all cards within a deck
+        void showCards(){
+            for (int i = top; i < (int)cards.size(); i++) {
+                cout << cards[i] << endl;
+            }
+
+            int numCards = remaining();
+            cout << "This deck has " << numCards << (numCards == 1 ? " card." : " cards." ) << endl;
+            return;
+        }
+
+        // Combines two decks of cards
+        void combine(const Deck &deck2) {
+            addCards(deck2.cards.begin() + deck2.top, deck2.cards.end());
+
+            return;
+        }
+
+        void addCards(const vector<Card> &source) {
+            addCards(source.begin(), source.end());
+
+            return;
+        }
+
+        // Shuffles a deck of cards, or two decks together
+        void shuffle() {
+            // Generate a new seed based on the current time
+            uint64_t seed = chrono::system_clock::now().time_since_epoch().count();
+            Xoshiro256 gen(seed);
+
+            // Use the new seed to shuffle the cards
+            Shoe::shuffle(gen);
+
+            cout << "The deck has been shuffled." << endl;
+            return;
+        }
+
+        using Shoe::shuffle;
+
+    private:
+        // Dealt cards are dropped before new cards are added, so the deck only holds cards left to deal
+        template <class Iterator>
+        void addCards(Iterator first, Iterator last) {
+            cards.erase(cards.begin(), cards.begin() + top);
+            top = 0;
+            for (Iterator card = first; card != last; ++card) {
+                cards.push_back(*card);
+                left.add(*card);
+            }
+
+            return;
+        }
+};
+
+// Class used for modelling a continuous shuffling machine. The cards sit on a carousel of shelves. The
+// discards are fed in after every round, one card at a time, each to a shelf picked at random from the ones
+// with room and slipped in at a random height in its stack. When the dealer runs out, the machine drops a
+// whole shelf, picked at random from the ones holding cards, into the tray the dealer deals from. Feeding a
+// card and dropping a shelf only touch the cards moved, whatever the size of the boot
+class ShufflingMachine {
+    public:
+        ShufflingMachine() {}
+
+        // Builds an empty machine with room for the given number of decks. Every shelf holds up to twice
+        // its share of the cards, so at least half the shelves always have room
+        ShufflingMachine(int numDecks, int numShelves) : shelves(max(1, numShelves)) {
+            int numCards = 52 * numDecks;
+            capacity = 2 * ((numCards + shelves - 1) / shelves) + 2;
+            slots.resize(shelves * capacity);
+            counts.assign(shelves, 0);
+            where.assign(shelves, -1);
+            stocked.reserve(shelves);
+        }
+
+        // Feeds cards into the machine in the given order
+        template <class Generator>
+        void insert(Generator& gen, const Card* returned, int n) {
+            for (int i = 0; i < n; i++) {
+                int shelf = bounded(gen, shelves);
+                while (counts[shelf] == capacity) { shelf = bounded(gen, shelves); }
+
+                // Slips the card in at a random height, one step of an inside-out Fisher-Yates shuffle
+                Card* stack = &slots[shelf * capacity];
+                int height = bounded(gen, counts[shelf] + 1);
+                stack[counts[shelf]] = stack[height];
+                stack[height] = returned[i];
+
+                if (counts[shelf]++ == 0) {
+                    where[shelf] = stocked.size();
+                    stocked.push_back(shelf);
+                }
+                inside.add(returned[i]);
+            }
+            return;
+        }
+
+        // Drops a random shelf into the tray, behind the cards left in it. Does nothing if the machine is empty
+        template <class Generator>
+        void drop(Generator& gen, Shoe& tray) {
+            if (stocked.empty()) { return; }
+
+            int pick = bounded(gen, stocked.size());
+            int shelf = stocked[pick];
+            const Card* stack = &slots[shelf * capacity];
+            tray.append(stack, counts[shelf]);
+            for (int i = 0; i < counts[shelf]; i++) { inside.remove(stack[i]); }
+            counts[shelf] = 0;
+
+            // The last shelf in the list takes this one's place
+            stocked[pick] = stocked.back();
+            where[stocked[pick]] = pick;
+            stocked.pop_back();
+            where[shelf] = -1;
+            return;
+        }
+
+        // How many of each card are in the machine
+        const Composition& composition() const { return inside; }
+        int size() const { return inside.total; }
+
+        // Writes the cards on every shelf, and the order the stocked shelves are picked from
+        template <class Out>
+        void save(Out& out) const {
+            out.write(counts.data(), counts.size() * sizeof(int));
+            out.write(slots.data(), slots.size() * sizeof(Card));
+            out.write((int)stocked.size());
+            out.write(stocked.data(), stocked.size() * sizeof(int));
+            return;
+        }
+
+        // Puts back a state written by save(). Returns false if it doesn't fit this machine
+        template <class In>
+        bool restore(In& in) {
+            int numStocked = 0;
+            if (!in.read(counts.data(), counts.size() * sizeof(int)) || !in.read(slots.data(), slots.size() * sizeof(Card))
+                || !in.read(numStocked)) { return false; }
+            if (numStocked < 0 || numStocked > shelves) { return false; }
+            stocked.resize(numStocked);
+            if (!in.read(stocked.data(), stocked.size() * sizeof(int))) { return false; }
+
+            inside = Composition();
+            where.assign(shelves, -1);
+            for (int shelf = 0; shelf < shelves; shelf++) {
+                if (counts[shelf] < 0 || counts[shelf] > capacity) { return false; }
+                for (int i = 0; i < counts[shelf]; i++) { inside.add(slots[shelf * capacity + i]); }
+            }
+            for (int i = 0; i < numStocked; i++) {
+                if (stocked[i] < 0 || stocked[i] >= shelves || counts[stocked[i]] == 0 || where[stocked[i]] != -1) { return false; }
+                where[stocked[i]] = i;
+            }
+            return count_if(counts.begin(), counts.end(), [](int n) { return n > 0; }) == numStocked;
+        }
+
+    private:
+        int shelves = 0;
+        int capacity = 0;           // The most cards a shelf can hold
+        vector<Card> slots;         // Shelf s holds slots[s * capacity] up to its count, bottom first
+        vector<int> counts;         // Cards on each shelf
+        vector<int> stocked;        // The shelves holding cards, in no particular order
+        vector<int> where;          // Where each shelf is in 'stocked', or -1 if it is empty
+        Composition inside;         // Every card in the machine
+};
+
+// Used to calculate the winnings for a player. Blackjack pays 3:2, or 6:5 at tables that pay less
+int payout(int bet, int total, int numCards, bool sixToFive = false) {
+    // If the player has blackjack
+    if (total == 21 && numCards == 2) {
+        return sixToFive ? bet + bet * 6 / 5 : bet + (bet * 1.5);
+    }
+
+    // If the player wins by regular means
+    return (bet * 2);
+}
+
+// What a hard total (Aces counted as 1) is worth, with and without an Ace in the hand. Looked up instead of
+// recalculated on every card.
+struct TotalInfo {
+    unsigned char best;     // The best total for the hand
+    bool soft;              // Whether an Ace is being counted as 11
+    bool bust;              // Whether the hand is over 21
+};
+
+// Hard totals above 31 can't happen, since nobody draws once they have 21 or more
+const int MAX_HARD_TOTAL = 32;
+
+struct TotalTable {
+    TotalInfo entries[2][MAX_HARD_TOTAL];   // [has an Ace][hard total]
+
+    constexpr TotalTable() : entries() {
+        for (int ace = 0; ace <= 1; ace++) {
+            for (int hard = 0; hard < MAX_HARD_TOTAL; hard++) {
+                bool soft = ace && hard <= 11;
+                entries[ace][hard] = { (unsigned char)(soft ? hard + 10 : hard), soft, hard > 21 };
+            }
+        }
+    }
+};
+
+constexpr TotalTable TOTALS;
+
+// The value of a hand, updated one card at a time as cards arrive
+struct HandValue {
+    unsigned char hard = 0;     // Total with every Ace counted as 1
+    bool ace = false;           // Whether the hand holds an Ace
+    unsigned char numCards = 0;
+
+    void add(const Card& card) {
+        hard += CARD_POINTS[card.value];
+        ace |= (card.value == 1);
+        numCards++;
+    }
+
+    const TotalInfo& info() const { return TOTALS.entries[ace][hard]; }
+
+    int total() const { return info().best; }
+    bool soft() const { return info().soft; }
+    bool bust() const { return info().bust; }
+    bool blackjack() const { return numCards == 2 && info().best == 21; }
+};
+
+// Calculates the value of a hand without printing anything. Works for a vector<Card> or a Hand
+template <class Cards>
+HandValue handValue(const Cards& hand) {
+    HandValue value;
+    for (const Card& card : hand) { value.add(card); }
+    return value;
+}
+
+/**********************
+ * Everything the console game says goes through an output sink instead of straight to cout. The game
+ * hands the sink one line at a time, tagged with what the line is about, asks it to pause for effect
+ * between cards, and tells it when the player is about to type and when a round is over.
+ *
+ * The terminal sink buffers its lines and only flushes before a pause or a question, so the game looks
+ * the same as it always has without flushing every line. In turbo mode it skips the pauses and flushes
+ * once a round, so a scripted session with its moves piped to stdin can play thousands of rounds a
+ * second. The null sink throws everything away, and the event sink writes each line to a log as JSON
+ * before passing it on to another sink.
+ *
+ **********************/
+
+// What a line of the game's output is about
+enum GameEvent { EVENT_MESSAGE, EVENT_PROMPT, EVENT_CARD, EVENT_TOTAL, EVENT_ADVICE, EVENT_OUTCOME, EVENT_SHUFFLE, NUM_GAME_EVENTS };
+
+const char* const EVENT_NAMES[NUM_GAME_EVENTS] = { "message", "prompt", "card", "total", "advice", "outcome", "shuffle" };
+
+class GameSink {
+    public:
+        virtual ~GameSink() = default;
+
+        // One line of output, without its newline. An empty line is just a gap
+        virtual void line(GameEvent event, const string& text) = 0;
+
+        // A pause for effect, e.g. between cards
+        virtual void pause(int /*milliseconds*/) {}
+
+        // The player is about to be asked for input, so anything they need to see should be shown
+        virtual void flush() {}
+
+        // The round is over
+        virtual void endRound() {}
+
+        // Builds a line out of anything that can be written to a stream, e.g. say(EVENT_CARD, "You draw ", card)
+        template <class... Parts>
+        void say(GameEvent event, const Parts&... parts) {
+            ostringstream text;
+            (text << ... << parts);
+            line(event, text.str());
+        }
+
+        void gap() { line(EVENT_MESSAGE, ""); }
+};
+
+// Writes to a terminal. Lines are buffered with '\n' rather than endl, and flushed before a pause or a question
+class TerminalSink : public GameSink {
+    public:
+        TerminalSink(ostream& out, bool turbo = false) : out(out), turbo(turbo) {
+            // In turbo mode, reading input mustn't flush the output either
+            if (turbo && &out == &cout) { cin.tie(nullptr); }
+        }
+
+        ~TerminalSink() { out.flush(); }
+
+        void line(GameEvent, const string& text) override { out << text << '\n'; }
+
+        void pause(int milliseconds) override {
+            if (turbo) { return; }
+            out.flush();
+            this_thread::sleep_for(chrono::milliseconds(milliseconds));
+        }
+
+        void flush() override {
+            if (!turbo) { out.flush(); }
+        }
+
+        void endRound() override { out.flush(); }
+
+    private:
+        ostream& out;
+        bool turbo;         // No pauses, and a single flush per round
+};
+
+// Throws all of the output away, for running the game headless
+class NullSink : public GameSink {
+    public:
+        void line(GameEvent, const string&) override {}
+};
+
+// Writes every line to a log as a JSON object, one per line, then passes it on to another sink (if any)
+class EventSink : public GameSink {
+    public:
+        EventSink(FILE* log, GameSink* next = nullptr) : log(log), next(next) {}
+
+        void line(GameEvent event, const string& text) override {
+            if (!text.empty()) {
+                fprintf(log, "{\"round\": %lld, \"event\": \"%s\", \"text\": \"", round, EVENT_NAMES[event]);
+                for (char c : text) {
+                    if (c == '"' || c == '\\') { fprintf(log, "\\%c", c); }
+                    else if ((unsigned char)c < 0x20) { fprintf(log, "\\u%04x", c); }
+                    else { fputc(c, log); }
+                }
+                fprintf(log, "\"}\n");
+            }
+            if (next) { next->line(event, text); }
+        }
+
+        void pause(int milliseconds) override {
+            if (next) { next->pause(milliseconds); }
+        }
+
+        void flush() override {
+            if (next) { next->flush(); }
+        }
+
+        void endRound() override {
+            round++;
+            fflush(log);
+            if (next) { next->endRound(); }
+        }
+
+    private:
+        FILE* log;
+        GameSink* next;
+        long long round = 1;
+};
+
+// Prints the total of a hand. Will return true if the player busts, otherwise false
+bool printTotal(GameSink& out, const HandValue& value) {
+    if (!value.bust()) {
+        out.gap();
+        if (value.soft() && value.total() < 21) {
+            out.say(EVENT_TOTAL, "You have ", value.total(), " or ", (int)value.hard);
+        } // If the player has an Ace counting as 11
+        else {
+            out.say(EVENT_TOTAL, "You have ", value.total());
+        } // Otherwise, print total
+
+        return false;
+    }
+    else {
+        out.say(EVENT_TOTAL, (int)value.hard, ", too many!");
+        out.pause(1000);
+        return true;
+    }
+}
+
+// Calculates and prints the total value in a player's hand. Will return true if the player busts, otherwise false
+template <class Cards>
+bool total(GameSink& out, const Cards& hand) {
+    return printTotal(out, handValue(hand));
+}
+
+template <class From, class To>
+void sendCard(From& hand, To& destination) {
+    if (!hand.empty()) {
+        destination.push_back(hand.back()); // Transfer the last card to the destination
+        hand.pop_back(); // Remove it from the hand without shifting the others
+    } else {
+        cout << "Hand is empty! Cannot transfer a card." << endl;
+    }
+
+    return;
+}
+
+void sendAllCards(vector<vector<Card>>& seats, vector<Card>& destination) {
+    for (auto& seat : seats) {
+        for (auto& card : seat) {
+            destination.push_back(card); // Transfer card from each seat to destination
+        }
+    }
+}
+
+/**********************
+ * Every round is played by a headless engine so the same rules can drive both the
+ * interactive game and simulations that play millions of hands. The engine never
+ * reads input, prints or sleeps.
+ *
+ * It is a small state machine. The front end places a bet, answers the insurance
+ * question when the dealer shows an Ace, and then picks an action for each hand until
+ * the round is over. Whoever drives it can print whatever they like between the steps,
+ * and a bot can drive it as fast as the cards can be dealt.
+ *
+ **********************/
+
+// How the boot is shuffled. A full shuffle mixes the whole boot up front; a lazy one picks each card at
+// random as it is dealt, so the cards left behind at the cut are never shuffled at all. A shared boot is
+// shuffled by whoever owns it and loaded into the game with loadShoe(), so several games can be dealt
+// the same cards; the game only shuffles it itself if it runs dry in the middle of a round. With a
+// shuffling machine there is no cut card: the discards go back into the machine after every round, and
+// the boot only holds the tray of cards the machine last dropped
+enum ShuffleMode { FULL_SHUFFLE, LAZY_SHUFFLE, SHARED_SHUFFLE, MACHINE_SHUFFLE };
+
+// The most hands a single player can hold after splitting
+const int MAX_HANDS = 4;
+
+// The house rules for a table
+struct Rules {
+    int numDecks = 4;               // Decks in the boot
+    int minBet = 5;                 // Smallest bet allowed at the table
+    int maxBet = 300;               // Largest bet allowed at the table
+    int reshuffleAt = 160;          // The boot is reshuffled once the discard pile holds more cards than this
+    int maxHands = 4;               // How many hands a player can split into
+    bool doubleAfterSplit = true;   // Whether a hand can be doubled after a split
+    bool hitSoft17 = false;         // Whether the dealer hits a soft 17 instead of standing on it
+    bool surrender = false;         // Whether a hand can be given up for half its bet before it takes a card
+    bool sixToFive = false;         // Whether blackjack pays 6:5 instead of 3:2
+    ShuffleMode shuffle = LAZY_SHUFFLE;
+    int shelves = 38;               // Shelves in the shuffling machine's carousel
+
+    // Whether the dealer takes another card
+    bool dealerHits(const HandValue& value) const {
+        return value.total() < 17 || (hitSoft17 && value.total() == 17 && value.soft());
+    }
+
+    // Whether a hand with these cards can be doubled down
+    bool canDouble(const Hand& cards, bool fromSplit) const {
+        return cards.size() == 2 && (!fromSplit || doubleAfterSplit);
+    }
+
+    // Whether a hand with these cards can be split, by a player already holding the given number of hands
+    bool canSplit(const Hand& cards, int handsHeld) const {
+        return cards.size() == 2 && cards[0].value == cards[1].value && handsHeld < min(maxHands, MAX_HANDS);
+    }
+
+    // Whether a hand can be surrendered. Only the first two cards can be, and never after a split
+    bool canSurrender(const Hand& cards, int handsHeld) const {
+        return surrender && handsHeld == 1 && cards.size() == 2;
+    }
+};
+
+// The actions from the "What will you do?" menu. Help is answered by the front end, the rest by the engine.
+// Surrender is only allowed at tables whose rules offer it
+enum Action { HELP = 0, HIT = 1, STAND = 2, DOUBLE = 3, SPLIT = 4, SURRENDER = 5 };
+
+// How a hand ended
+enum Outcome { PENDING, WIN, BLACKJACK, PUSH, LOSS, BUST, SURRENDERED };
+
+// A hand held by the player, along with the bet riding on it
+struct PlayerHand {
+    Hand cards;
+    HandValue value;            // Kept up to date as cards are dealt
+    int bet = 0;
+    bool doubled = false;       // Doubled hands receive exactly one more card
+    bool fromSplit = false;     // A two card 21 after a split is not blackjack
+    Outcome outcome = PENDING;
+    int won = 0;                // Chips paid back at settlement, including the bet
+};
+
+// Hands in play for a single round. Hands are handed out from a fixed block as the player splits and are
+// all given back at once when the next round starts, so a round never goes to the heap for them
+class RoundArena {
+    public:
+        // Hands out a fresh hand. There is always room, since splits are capped at MAX_HANDS
+        PlayerHand& allocate() {
+            PlayerHand& hand = slots[used++];
+            hand = PlayerHand();
+            return hand;
+        }
+
+        // Gives back every hand at once
+        void reset() { used = 0; }
+
+        PlayerHand& operator[](int i) { return slots[i]; }
+        const PlayerHand& operator[](int i) const { return slots[i]; }
+        int size() const { return used; }
+
+    private:
+        PlayerHand slots[MAX_HANDS];
+        int used = 0;
+};
+
+// The odds on the insurance bet, from the cards the player hasn't seen. Insurance pays 2:1 when the dealer's
+// face down card is a ten, so each chip placed wins 3p - 1 on average, where p is the share of unseen cards
+// that are tens. It is worth taking when more than a third of them are
+struct InsuranceOdds {
+    int tens = 0;       // Unseen tens, counting the dealer's face down card if it is one
+    int cards = 0;      // Unseen cards, counting the dealer's face down card
+
+    double tenChance() const { return cards ? (double)tens / cards : 0.0; }
+    double ev() const { return 3.0 * tenChance() - 1.0; }
+    bool worthTaking() const { return 3 * tens > cards; }
+
+    // Chips won per chip bet by a blackjack against an Ace, with and without even money (insuring for half the bet)
+    double blackjackEV(bool sixToFive) const { return (sixToFive ? 1.2 : 1.5) * (1.0 - tenChance()); }
+    double evenMoneyEV(bool sixToFive) const { return blackjackEV(sixToFive) + 0.5 * ev(); }
+};
+
+// Everything that happened to the player's money over a round
+struct RoundResult {
+    int bet = 0;                // The opening bet
+    int insurance = 0;          // Chips placed on insurance
+    int wagered = 0;            // Every chip put at risk, including doubles, splits and insurance
+    int returned = 0;           // Every chip paid back to the player
+    int net = 0;                // returned - wagered
+    int numHands = 0;           // Hands held after splitting
+    Outcome outcomes[MAX_HANDS] = {};
+    bool dealerBlackjack = false;
+    int dealerTotal = 0;
+    bool reshuffled = false;    // Whether the boot was reshuffled after this round
+    InsuranceOdds insuranceOdds;    // The odds when insurance was offered. No cards if it wasn't
+};
+
+/**********************
+ * Building with -DBLACKJACK_INSTRUMENT times every stage of a round: building and shuffling the boot, the
+ * initial deal, insurance, the player's turn, the dealer's turn, settling up and reshuffling. Each thread
+ * records into its own histograms, with no locks or shared cache lines on the hot path, and adds them to
+ * the process totals when it exits. Without the flag the macros below expand to nothing.
+ *
+ * Stages nest (a reshuffle can happen in the middle of the deal, and the dealer plays from inside the
+ * player's last action), so each timer pauses the one around it and every stage records only its own time.
+ *
+ * The histograms are log-linear like HDR histograms: values below 16ns get a bucket each, and every power
+ * of two above that is split into 16 buckets, so any value is known to within about 6%.
+ **********************/
+
+// The stages of a round that are timed
+enum Stage { STAGE_SHOE, STAGE_DEAL, STAGE_INSURANCE, STAGE_PLAYER, STAGE_DEALER, STAGE_SETTLE, STAGE_RESHUFFLE, NUM_STAGES };
+const char* const STAGE_NAMES[NUM_STAGES] = { "shoe", "deal", "insurance", "player_turn", "dealer_turn", "settle", "reshuffle" };
+
+// The events that are counted
+enum Counter { COUNT_ROUNDS, COUNT_CARDS, COUNT_ACTIONS, COUNT_RESHUFFLES, NUM_COUNTERS };
+const char* const COUNTER_NAMES[NUM_COUNTERS] = { "rounds", "cards_dealt", "actions", "reshuffles" };
+
+// A histogram of latencies in nanoseconds, with a fixed number of log-linear buckets
+class LatencyHistogram {
+    public:
+        static const int SUB_BITS = 4;
+        static const int SUB_BUCKETS = 1 << SUB_BITS;
+        static const int BUCKETS = SUB_BUCKETS * (64 - SUB_BITS + 1);
+
+        void add(uint64_t ns) {
+            counts[bucket(ns)]++;
+            count++;
+            sum += ns;
+            low = min(low, ns);
+            high = max(high, ns);
+            return;
+        }
+
+        void merge(const LatencyHistogram& other) {
+            for (int i = 0; i < BUCKETS; i++) { counts[i] += other.counts[i]; }
+            count += other.count;
+            sum += other.sum;
+            low = min(low, other.low);
+            high = max(high, other.high);
+            return;
+        }
+
+        // The bucket a value falls in. The first SUB_BUCKETS values have one each
+        static int bucket(uint64_t ns) {
+            if (ns < SUB_BUCKETS) { return (int)ns; }
+#if defined(__GNUC__) || defined(__clang__)
+            int shift = 63 - __builtin_clzll(ns) - SUB_BITS;
+#else
+            int shift = 0;
+            while (ns >> (shift + SUB_BITS + 1)) { shift++; }
+#endif
+            return shift * SUB_BUCKETS + (int)(ns >> shift);
+        }
+
+        // The largest value that falls in a bucket
+        static uint64_t upperBound(int i) {
+            if (i < 2 * SUB_BUCKETS) { return i; }
+            int shift = i / SUB_BUCKETS - 1;
+            return (((uint64_t)(i % SUB_BUCKETS + SUB_BUCKETS + 1)) << shift) - 1;
+        }
+
+        // The value that a share q of the samples are at or below, to within a bucket
+        uint64_t quantile(double q) const {
+            if (count == 0) { return 0; }
+            uint64_t rank = (uint64_t)ceil(q * count), seen = 0;
+            for (int i = 0; i < BUCKETS; i++) {
+                seen += counts[i];
+                if (seen >= max<uint64_t>(rank, 1)) { return min(upperBound(i), high); }
+            }
+            return high;
+        }
+
+        uint64_t counts[BUCKETS] = {};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t low = UINT64_MAX;
+        uint64_t high = 0;
+};
+
+// Everything one thread has recorded
+struct Metrics {
+    LatencyHistogram stages[NUM_STAGES];
+    uint64_t counters[NUM_COUNTERS] = {};
+
+    void merge(const Metrics& other) {
+        for (int i = 0; i < NUM_STAGES; i++) { stages[i].merge(other.stages[i]); }
+        for (int i = 0; i < NUM_COUNTERS; i++) { counters[i] += other.counters[i]; }
+        return;
+    }
+};
+
+#ifdef BLACKJACK_INSTRUMENT
+
+// The totals of every thread that has exited
+Metrics& processMetrics() {
+    static Metrics totals;
+    return totals;
+}
+
+mutex& metricsLock() {
+    static mutex lock;
+    return lock;
+}
+
+// A thread's own metrics, added to the process totals when the thread exits
+struct ThreadMetrics {
+    Metrics local;
+    ~ThreadMetrics() {
+        lock_guard<mutex> hold(metricsLock());
+        processMetrics().merge(local);
+    }
+};
+
+thread_local ThreadMetrics threadMetrics;
+
+// Times a stage of a round from construction to destruction, less any stage timed inside it
+class StageTimer {
+    public:
+        explicit StageTimer(Stage timed) : stage(timed), outer(active) {
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            if (outer) { outer->elapsed += now - outer->start; }
+            start = now;
+            active = this;
+        }
+
+        ~StageTimer() {
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            elapsed += now - start;
+            threadMetrics.local.stages[stage].add(chrono::duration_cast<chrono::nanoseconds>(elapsed).count());
+
+            active = outer;
+            if (outer) { outer->start = now; }
+        }
+
+        StageTimer(const StageTimer&) = delete;
+        StageTimer& operator=(const StageTimer&) = delete;
+
+    private:
+        static thread_local StageTimer* active;     // The innermost stage being timed on this thread
+
+        Stage stage;
+        StageTimer* outer;
+        chrono::steady_clock::time_point start;
+        chrono::steady_clock::duration elapsed = chrono::steady_clock::duration::zero();
+};
+
+thread_local StageTimer* StageTimer::active = nullptr;
+
+#define INSTRUMENT_STAGE(stage) StageTimer stageTimer_(stage)
+#define INSTRUMENT_COUNT(counter, n) (threadMetrics.local.counters[counter] += (n))
+
+// Everything recorded so far: the threads that have exited, plus the calling thread
+Metrics collectMetrics() {
+    lock_guard<mutex> hold(metricsLock());
+    Metrics totals = processMetrics();
+    totals.merge(threadMetrics.local);
+    return totals;
+}
+
+#else
+
+#define INSTRUMENT_STAGE(stage) ((void)0)
+#define INSTRUMENT_COUNT(counter, n) ((void)0)
+
+#endif
+
+// Writes the metrics as JSON: the counters, then each stage's count, total, range, percentiles and non-empty buckets
+void writeMetricsJson(FILE* out, const Metrics& metrics) {
+    fprintf(out, "{\n  \"counters\": {");
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        fprintf(out, "%s\n    \"%s\": %llu", i ? "," : "", COUNTER_NAMES[i], (unsigned long long)metrics.counters[i]);
+    }
+    fprintf(out, "\n  },\n  \"stages\": {");
+
+    for (int s = 0; s < NUM_STAGES; s++) {
+        const LatencyHistogram& h = metrics.stages[s];
+        fprintf(out, "%s\n    \"%s\": {\"count\": %llu, \"total_ns\": %llu, \"min_ns\": %llu, \"max_ns\": %llu, "
+                     "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"buckets\": [",
+                s ? "," : "", STAGE_NAMES[s], (unsigned long long)h.count, (unsigned long long)h.sum,
+                (unsigned long long)(h.count ? h.low : 0), (unsigned long long)h.high,
+                (unsigned long long)h.quantile(0.5), (unsigned long long)h.quantile(0.9),
+                (unsigned long long)h.quantile(0.99), (unsigned long long)h.quantile(0.999));
+
+        // Each bucket is written as [largest value, samples]
+        bool first = true;
+        for (int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            if (h.counts[i] == 0) { continue; }
+            fprintf(out, "%s[%llu, %llu]", first ? "" : ", ", (unsigned long long)LatencyHistogram::upperBound(i),
+                    (unsigned long long)h.counts[i]);
+            first = false;
+        }
+        fprintf(out, "]}");
+    }
+
+    fprintf(out, "\n  }\n}\n");
+    return;
+}
+
+// Writes the metrics in the Prometheus text format. Stage histograms are cumulative, with a bucket at every power of two
+void writeMetricsPrometheus(FILE* out, const Metrics& metrics) {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        fprintf(out, "# TYPE blackjack_%s_total counter\nblackjack_%s_total %llu\n", COUNTER_NAMES[i], COUNTER_NAMES[i],
+                (unsigned long long)metrics.counters[i]);
+    }
+
+    fprintf(out, "# HELP blackjack_stage_seconds Time spent in each stage of a round\n# TYPE blackjack_stage_seconds histogram\n");
+    for (int s = 0; s < NUM_STAGES; s++) {
+        const LatencyHistogram& h = metrics.stages[s];
+        uint64_t below = 0;
+        int i = 0;
+
+        // Powers of two from 16ns to about 17s
+        for (int power = LatencyHistogram::SUB_BITS; power <= 34; power++) {
+            uint64_t bound = (1ULL << power) - 1;
+            while (i < LatencyHistogram::BUCKETS && LatencyHistogram::upperBound(i) <= bound) { below += h.counts[i++]; }
+            fprintf(out, "blackjack_stage_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n", STAGE_NAMES[s],
+                    (double)bound * 1e-9, (unsigned long long)below);
+        }
+        fprintf(out, "blackjack_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", STAGE_NAMES[s], (unsigned long long)h.count);
+        fprintf(out, "blackjack_stage_seconds_sum{stage=\"%s\"} %.9f\n", STAGE_NAMES[s], h.sum * 1e-9);
+        fprintf(out, "blackjack_stage_seconds_count{stage=\"%s\"} %llu\n", STAGE_NAMES[s], (unsigned long long)h.count);
+    }
+    return;
+}
+
+// Writes everything recorded so far to a JSON file and a Prometheus text file. Either path can be left empty.
+// Returns false if this build has no instrumentation or a file can't be written
+bool dumpMetrics(const string& jsonPath, const string& promPath) {
+#ifdef BLACKJACK_INSTRUMENT
+    Metrics metrics = collectMetrics();
+    const string paths[2] = { jsonPath, promPath };
+
+    for (int f = 0; f < 2; f++) {
+        if (paths[f].empty()) { continue; }
+
+        // Written beside the target and renamed over it, so a scraper never reads half a file
+        string temp = paths[f] + ".tmp";
+        FILE* out = fopen(temp.c_str(), "w");
+        if (!out) {
+            cout << "Can't write " << paths[f] << endl;
+            return false;
+        }
+
+        if (f == 0) { writeMetricsJson(out, metrics); }
+        else { writeMetricsPrometheus(out, metrics); }
+
+        bool written = fclose(out) == 0 && rename(temp.c_str(), paths[f].c_str()) == 0;
+        if (!written) {
+            cout << "Can't write " << paths[f] << endl;
+            return false;
+        }
+    }
+    return true;
+#else
+    if (!jsonPath.empty() || !promPath.empty()) {
+        cout << "This build has no metrics to write. Build with -DBLACKJACK_INSTRUMENT to record them." << endl;
+    }
+    return false;
+#endif
+}
+
+/**********************
+ * The book moves come from a basic strategy chart that is built at compile time. Each rule set gets its
+ * own chart, since the best play changes a little with the number of decks and whether doubling after a
+ * split is allowed. A chart is a table indexed by the kind of hand (hard, soft or a pair), the player's
+ * total (or the card that is paired) and the dealer's up card, so looking up a move is a single read.
+ *
+ * Every cell holds two moves. The low four bits are the book move, and the high four bits are what to do
+ * instead when the hand can no longer double down (after taking a third card, for example).
+ *
+ * Surrender is kept apart from the moves, as a flag for each hard total, since it is only ever allowed as
+ * the first decision and a hand that can't surrender just plays the chart.
+ **********************/
+
+// The kinds of hand that the chart tells apart
+enum HandClass { HARD = 0, SOFT = 1, PAIR = 2 };
+
+// The most useful rows in the chart. Hard and soft rows are indexed by total, pair rows by the card's points
+const int STRATEGY_ROWS = 22;
+
+struct StrategyTable {
+    unsigned char cells[3][STRATEGY_ROWS][11];   // [hand class][total or paired card][dealer up card points, Ace = 1]
+    bool surrender[STRATEGY_ROWS][11];           // [hard total][dealer up card points]
+
+    // Finds the book move. Doubling falls back to the second move when it isn't allowed
+    constexpr Action lookup(int handClass, int row, int dealerUp, bool canDouble) const {
+        return (Action)((cells[handClass][row][dealerUp] >> (4 * !canDouble)) & 15);
+    }
+};
+
+// Packs a book move with the move to make when doubling isn't allowed
+constexpr unsigned char move(Action best, Action otherwise) { return best | (otherwise << 4); }
+
+// Builds the basic strategy chart for a number of decks, with or without doubling after a split, for a dealer
+// who stands or hits on soft 17
+constexpr StrategyTable makeStrategy(int numDecks, bool doubleAfterSplit, bool hitSoft17) {
+    const unsigned char H = move(HIT, HIT), S = move(STAND, STAND), P = move(SPLIT, SPLIT);
+    const unsigned char Dh = move(DOUBLE, HIT), Ds = move(DOUBLE, STAND);
+
+    StrategyTable table = {};
+
+    for (int dealerUp = 1; dealerUp <= 10; dealerUp++) {
+        int up = (dealerUp == 1 ? 11 : dealerUp);   // Ranges below are easier to read with the Ace as 11
+
+        // Hard totals
+        for (int total = 0; total < STRATEGY_ROWS; total++) {
+            unsigned char cell = H;
+
+            // 17 or more: always stand
+            if (total >= 17) { cell = S; }
+            // 13-16: stand when the dealer shows 2-6, since the dealer has a higher chance of busting
+            else if (total >= 13) { cell = (up <= 6 ? S : H); }
+            // 12: stand only against 4-6
+            else if (total == 12) { cell = (up >= 4 && up <= 6 ? S : H); }
+            // 11: double against everything but an Ace, and against an Ace too with one or two decks or when
+            // the dealer hits soft 17
+            else if (total == 11) { cell = (up <= 10 || numDecks <= 2 || hitSoft17 ? Dh : H); }
+            // 10: double against 2-9
+            else if (total == 10) { cell = (up <= 9 ? Dh : H); }
+            // 9: double against 3-6, or 2-6 with one or two decks
+            else if (total == 9) { cell = (up >= 3 && up <= 6) || (numDecks <= 2 && up == 2) ? Dh : H; }
+            // 8: double against 5-6 with a single deck
+            else if (total == 8) { cell = (numDecks == 1 && up >= 5 && up <= 6 ? Dh : H); }
+
+            table.cells[HARD][total][dealerUp] = cell;
+
+            // Surrender 16 against 9, 10 and Ace, and 15 against 10. When the dealer hits soft 17, also
+            // surrender 15 and 17 against an Ace
+            table.surrender[total][dealerUp] = (total == 16 && up >= 9) || (total == 15 && up == 10)
+                || (hitSoft17 && up == 11 && (total == 15 || total == 17));
+        }
+
+        // Soft totals. Soft 12 is a pair of Aces that can't be split, so it is hit like the rest of the small hands
+        for (int total = 12; total <= 21; total++) {
+            unsigned char cell = H;
+
+            // Soft 13-14: double against 5-6, or 4-6 with a single deck
+            if (total <= 14 && total >= 13) { cell = (up >= (numDecks == 1 ? 4 : 5) && up <= 6 ? Dh : H); }
+            // Soft 15-16: double against 4-6
+            else if (total <= 16 && total >= 15) { cell = (up >= 4 && up <= 6 ? Dh : H); }
+            // Soft 17: double against 3-6
+            else if (total == 17) { cell = (up >= 3 && up <= 6 ? Dh : H); }
+            // Soft 18: double against 3-6 (and 2 when the dealer hits soft 17), stand against 2, 7 and 8, hit
+            // against 9, 10 and Ace
+            else if (total == 18) { cell = ((up >= 3 || hitSoft17) && up <= 6 ? Ds : up <= 8 ? S : H); }
+            // Soft 19: stand, except doubling against a 6 with a single deck or when the dealer hits soft 17
+            else if (total == 19) { cell = ((numDecks == 1 || hitSoft17) && up == 6 ? Ds : S); }
+            // Soft 20 and 21: always stand
+            else if (total >= 20) { cell = S; }
+
+            table.cells[SOFT][total][dealerUp] = cell;
+        }
+
+        // Pairs. A pair that shouldn't be split is played like the hard total it makes
+        for (int card = 1; card <= 10; card++) {
+            bool split = false;
+
+            switch (card) {
+                // Aces and 8s: always split
+                case 1: case 8: split = true; break;
+                // 9s: split against 2-6, 8 and 9. Against 7, 10 or an Ace it is better to stand
+                case 9: split = (up <= 9 && up != 7); break;
+                // 7s: split against 2-7
+                case 7: split = (up <= 7); break;
+                // 6s: split against 2-6, or 3-6 if the new hands can't be doubled
+                case 6: split = (up >= (doubleAfterSplit ? 2 : 3) && up <= 6); break;
+                // 4s: split against 5-6, and only if the new hands can be doubled
+                case 4: split = (doubleAfterSplit && up >= 5 && up <= 6); break;
+                // 2s and 3s: split against 2-7, or 4-7 if the new hands can't be doubled
+                case 2: case 3: split = (up >= (doubleAfterSplit ? 2 : 4) && up <= 7); break;
+                // Never split 5s or 10s!
+                default: break;
+            }
+
+            table.cells[PAIR][card][dealerUp] = split ? P : (card == 1 ? table.cells[SOFT][12][dealerUp] : table.cells[HARD][2 * card][dealerUp]);
+        }
+    }
+
+    return table;
+}
+
+// Every chart the game knows about, built at compile time:
+// [one deck, two decks, more][no double after split, double after split][dealer stands on soft 17, hits soft 17]
+constexpr StrategyTable STRATEGIES[3][2][2] = {
+    { { makeStrategy(1, false, false), makeStrategy(1, false, true) }, { makeStrategy(1, true, false), makeStrategy(1, true, true) } },
+    { { makeStrategy(2, false, false), makeStrategy(2, false, true) }, { makeStrategy(2, true, false), makeStrategy(2, true, true) } },
+    { { makeStrategy(4, false, false), makeStrategy(4, false, true) }, { makeStrategy(4, true, false), makeStrategy(4, true, true) } },
+};
+
+// Picks the chart that matches a table's rules
+const StrategyTable& basicStrategy(const Rules& rules) {
+    int decks = (rules.numDecks <= 1 ? 0 : rules.numDecks == 2 ? 1 : 2);
+    return STRATEGIES[decks][rules.doubleAfterSplit][rules.hitSoft17];
+}
+
+// Finds the book move for a hand against the dealer's up card
+Action bookAction(const StrategyTable& table, const HandValue& value, const Card& firstCard, const Card& upCard, bool canDouble, bool canSplit,
+                  bool canSurrender = false) {
+    int handClass = canSplit ? PAIR : value.soft() ? SOFT : HARD;
+    int row = canSplit ? CARD_POINTS[firstCard.value] : value.total();
+    int up = CARD_POINTS[upCard.value];
+
+    Action action = table.lookup(handClass, row, up, canDouble);
+
+    // A pair worth splitting is split rather than surrendered
+    if (canSurrender && action != SPLIT && !value.soft() && table.surrender[value.total()][up]) { return SURRENDER; }
+    return action;
+}
+
+// Tells the player the book move for their hand. The dealer's second card is the one facing up
+template <class Cards>
+Action bookMove(GameSink& out, const Cards& yourHand, const Cards& dealerHand, bool canDouble = true, bool canSplit = true,
+               const Rules& rules = Rules()) {
+    static const char* const moves[] = { "ask for help", "hit", "stand", "double down", "split", "surrender" };
+
+    HandValue value = handValue(yourHand);
+    canSplit = canSplit && yourHand.size() == 2 && yourHand[0].value == yourHand[1].value;
+
+    Action action = bookAction(basicStrategy(rules), value, yourHand[0], dealerHand[1], canDouble && yourHand.size() == 2, canSplit);
+    out.gap();
+    out.say(EVENT_ADVICE, "The book says you should ", moves[action], ".");
+
+    return action;
+}
+
+// The cards a dealer deals from: the boot, the shuffling machine when the table has one, and the generator that
+// shuffles them. It keeps track of the cards dealt in the current round, so the boot can be restocked in the
+// middle of a round without touching them. Game and Table each deal from one
+class DealingShoe {
+    public:
+        // Builds and shuffles the boot. The seed makes every shuffle reproducible
+        DealingShoe(const Rules& tableRules, uint64_t seed) : rules(tableRules), gen(seed) {
+            INSTRUMENT_STAGE(STAGE_SHOE);
+            boot.fill(rules.numDecks);
+            if (rules.shuffle == FULL_SHUFFLE) { boot.shuffle(gen); }
+            if (rules.shuffle == MACHINE_SHUFFLE) { loadMachine(); }
+        }
+
+        // Deals the next card. If the boot runs dry, the discards are reshuffled while the cards on the table
+        // stay where they are
+        Card draw() {
+            if (scriptLeft > 0) {
+                scriptLeft--;
+                return *script++;
+            }
+
+            if (boot.empty()) {
+                restock(tableCards);
+
+                // With few decks, many seats and many splits, every card can end up on the table at once
+                if (boot.empty()) {
+                    cerr << "Every card in the boot is on the table, so there are none left to deal. Play with more decks or fewer seats" << endl;
+                    exit(1);
+                }
+            }
+            tableCards++;
+            INSTRUMENT_COUNT(COUNT_CARDS, 1);
+            return rules.shuffle == LAZY_SHUFFLE ? boot.dealRandom(gen) : boot.deal();
+        }
+
+        // Gathers the cards from the table once a round is over, and reshuffles the boot if the discard pile is
+        // full. Returns whether it was reshuffled
+        bool endRound() {
+            // Every card dealt since the last shuffle is now in the discard pile
+            tableCards = 0;
+
+            // A shuffling machine takes the discards back after every round
+            if (rules.shuffle == MACHINE_SHUFFLE) {
+                feedMachine();
+                return false;
+            }
+
+            // Time to shuffle the boot!
+            if (boot.dealt() > rules.reshuffleAt) {
+                restock(0);
+                return true;
+            }
+            return false;
+        }
+
+        // The cards nobody at the table has seen: everything left in the boot and the machine, plus the dealer's
+        // face down card while it is still face down
+        Composition unseen(const Card* faceDown = nullptr) const {
+            Composition cards = boot.composition();
+            cards.add(machine.composition());
+            if (faceDown) { cards.add(*faceDown); }
+            return cards;
+        }
+
+        // The odds on insurance, from the same unseen cards. The boot and the machine keep their counts up to date
+        // as each card is dealt, so this reads a few counters rather than the cards
+        InsuranceOdds insuranceOdds(const Card* faceDown = nullptr) const {
+            InsuranceOdds odds;
+            odds.tens = boot.composition().counts[10] + machine.composition().counts[10];
+            odds.cards = boot.composition().total + machine.composition().total;
+            if (faceDown) {
+                odds.tens += CARD_POINTS[faceDown->value] == 10;
+                odds.cards++;
+            }
+            return odds;
+        }
+
+        // Every card dealt from the boot this round, in the order it was dealt. Valid until endRound()
+        const Card* roundCards() const { return boot.dealtCards(tableCards); }
+        int roundCardCount() const { return tableCards; }
+        int position() const { return boot.dealt() - tableCards; }
+
+        // Deals the given cards in order, in place of the boot, until they run out. Used to replay a logged round
+        void scriptCards(const Card* cards, int count) {
+            script = cards;
+            scriptLeft = count;
+        }
+
+        // Replaces the boot with a shuffled order of the same cards. Used with a shared boot
+        void load(const Card* order) {
+            INSTRUMENT_STAGE(STAGE_RESHUFFLE);
+            boot.load(order, boot.size());
+            return;
+        }
+
+        // Writes everything that carries over from one round to the next: the boot's order, how far it has been
+        // dealt (the cards before that are the discard pile), the shuffling machine's shelves and the generator.
+        // Only valid between rounds
+        template <class Out>
+        void save(Out& out) const {
+            out.write(boot.dealt());
+            out.write(boot.size());
+            out.write(boot.data(), boot.size());
+            if (rules.shuffle == MACHINE_SHUFFLE) { machine.save(out); }
+            out.write(gen);
+            return;
+        }
+
+        // Puts back a state written by save(). Returns false if it doesn't fit this boot
+        template <class In>
+        bool restore(In& in) {
+            int dealt = 0, size = 0;
+            int numCards = 52 * rules.numDecks;
+            if (!in.read(dealt) || !in.read(size) || size < 0 || size > numCards || dealt < 0 || dealt > size) { return false; }
+
+            vector<Card> order(size);
+            if (!in.read(order.data(), order.size())) { return false; }
+            if (rules.shuffle == MACHINE_SHUFFLE && !machine.restore(in)) { return false; }
+            if (!in.read(gen)) { return false; }
+
+            boot.load(order.data(), size, dealt);
+            return boot.composition().total + dealt + machine.size() == numCards;
+        }
+
+    private:
+        // Returns the discards to the boot. A lazy boot is shuffled as it is dealt, so it doesn't need shuffling here,
+        // and a shared boot is shuffled by its owner unless it runs dry in the middle of a round. A shuffling
+        // machine keeps the discards, and drops another shelf into the tray instead
+        void restock(int keep) {
+            INSTRUMENT_STAGE(STAGE_RESHUFFLE);
+            if (rules.shuffle == MACHINE_SHUFFLE) {
+                machine.drop(gen, boot);
+                return;
+            }
+
+            INSTRUMENT_COUNT(COUNT_RESHUFFLES, 1);
+            if (rules.shuffle == LAZY_SHUFFLE || (rules.shuffle == SHARED_SHUFFLE && keep == 0)) { boot.collect(keep); }
+            else { boot.reshuffle(gen, keep); }
+            return;
+        }
+
+        // Moves every card into the shuffling machine, leaving the boot as an empty tray. The boot keeps its
+        // room for every card, so the tray never reallocates
+        void loadMachine() {
+            machine = ShufflingMachine(rules.numDecks, rules.shelves);
+            machine.insert(gen, boot.data(), boot.size());
+            boot.clear();
+            return;
+        }
+
+        // Feeds the cards dealt since the last feed into the shuffling machine. The cards still in the tray stay there
+        void feedMachine() {
+            INSTRUMENT_STAGE(STAGE_RESHUFFLE);
+            machine.insert(gen, boot.data(), boot.dealt());
+            boot.release();
+            return;
+        }
+
+        Rules rules;
+        Shoe boot;                      // The shuffled boot the dealer draws from. Dealt cards are the discard pile
+        ShufflingMachine machine;       // Holds the cards off the table when they are shuffled by a machine
+        int tableCards = 0;             // Cards dealt in the current round
+        Xoshiro256 gen;                 // Shuffles the boot
+        const Card* script = nullptr;   // Cards to deal before the boot, when replaying
+        int scriptLeft = 0;
+};
+
+/**********************
+ * Game and Table play by the same rules and only keep their hands differently: a Game keeps each hand whole,
+ * and a Table keeps each field of every hand in an array of its own. The rules are written once, in
+ * RoundEngine, which reaches a hand through a HandView of references to wherever its fields are kept:
+ * insurance, the player's actions, the dealer's peek and play, and settling each hand.
+ *
+ * RoundEngine is a base that knows which engine it is part of, so it calls the engine's own few hooks
+ * directly and they are inlined like the rest of the round.
+ **********************/
+
+// One hand as the rules see it, made of references to wherever the hand's fields are kept
+struct HandView {
+    Hand& cards;
+    unsigned char& hard;
+    bool& ace;
+    unsigned char& numCards;
+    int& bet;
+    int& won;
+    bool& doubled;
+    bool& fromSplit;
+    Outcome& outcome;
+
+    HandView(PlayerHand& hand)
+        : cards(hand.cards), hard(hand.value.hard), ace(hand.value.ace), numCards(hand.value.numCards), bet(hand.bet),
+          won(hand.won), doubled(hand.doubled), fromSplit(hand.fromSplit), outcome(hand.outcome) {}
+
+    HandView(Hand& handCards, unsigned char& handHard, bool& handAce, unsigned char& handNumCards, int& handBet, int& handWon,
+             bool& handDoubled, bool& handFromSplit, Outcome& handOutcome)
+        : cards(handCards), hard(handHard), ace(handAce), numCards(handNumCards), bet(handBet), won(handWon),
+          doubled(handDoubled), fromSplit(handFromSplit), outcome(handOutcome) {}
+
+    int total() const { return TOTALS.entries[ace][hard].best; }
+    bool bust() const { return TOTALS.entries[ace][hard].bust; }
+    bool blackjack() const { return numCards == 2 && total() == 21; }
+
+    // Whether the dealer still has to beat this hand
+    bool standing() const { return !bust() && outcome != SURRENDERED; }
+
+    // Puts a card into the hand and keeps its total up to date
+    void add(const Card& card) {
+        cards.push_back(card);
+        hard += CARD_POINTS[card.value];
+        ace |= (card.value == 1);
+        numCards++;
+        return;
+    }
+
+    // Takes the last card back out of the hand
+    Card takeBack() {
+        Card card = cards.back();
+        cards.pop_back();
+        hard -= CARD_POINTS[card.value];
+        numCards--;
+        return card;
+    }
+};
+
+// The phases a round goes through
+struct RoundPhases {
+    enum Phase { BETTING, INSURANCE, PLAYER_TURN, ROUND_OVER };
+};
+
+// The dealer's side of a round, and the rules every hand is played by. The engine it is part of keeps the
+// hands and answers for whoever's turn it is:
+//      - int handCount() const             how many hands they hold
+//      - HandView handView(int i)          their i-th hand
+//      - HandView addHand()                a fresh hand for them, when they split
+//      - RoundResult& playerResult()       what the round has done to their money
+//      - bool canDouble() const, canSplit() const, canSurrender() const
+//      - void handsPlayed()                moves on once they have played every hand
+//      - void forEachHandInPlay(f)         calls f with every hand the dealer plays against
+//      - void finishRound()                totals the round up once every hand is settled
+template <class Engine>
+class RoundEngine : public RoundPhases {
+    public:
+        Phase getPhase() const { return phase; }
+        const Rules& getRules() const { return rules; }
+
+        const Hand& dealerHand() const { return dealer; }
+        const Card& upCard() const { return dealer[1]; }    // The dealer's first card is face down
+
+        // The cards the players haven't seen, and the odds on insurance they give
+        Composition unseen() const { return shoe.unseen(faceDown()); }
+        InsuranceOdds insuranceOdds() const { return shoe.insuranceOdds(faceDown()); }
+
+        int currentHand() const { return current; }
+
+        // Applies an action to the current hand. Returns false if the action is not allowed
+        bool act(Action action) {
+            if (phase != PLAYER_TURN) { return false; }
+            INSTRUMENT_STAGE(STAGE_PLAYER);
+            INSTRUMENT_COUNT(COUNT_ACTIONS, 1);
+            HandView hand = engine().handView(current);
+
+            switch (action) {
+                case HIT:
+                    draw(hand);
+                    if (hand.total() >= 21) { nextHand(); }
+                    return true;
+                case STAND:
+                    nextHand();
+                    return true;
+                case DOUBLE:
+                    if (!engine().canDouble()) { return false; }
+                    engine().playerResult().wagered += hand.bet;
+                    hand.bet *= 2;
+                    hand.doubled = true;
+                    draw(hand);
+                    nextHand();
+                    return true;
+                case SPLIT: {
+                    if (!engine().canSplit()) { return false; }
+                    HandView other = engine().addHand();
+                    other.bet = hand.bet;
+                    other.fromSplit = true;
+                    hand.fromSplit = true;
+                    engine().playerResult().wagered += hand.bet;
+
+                    // Each half of the pair receives a second card. Both cards match, so the Ace flag stays right
+                    other.add(hand.takeBack());
+                    draw(hand);
+                    draw(other);
+
+                    // Split Aces only receive one card each
+                    if (hand.cards[0].value == 1) {
+                        current = engine().handCount() - 1;
+                        nextHand();
+                    }
+                    else if (hand.total() == 21) {
+                        nextHand();
+                    }
+                    return true;
+                }
+                case SURRENDER:
+                    // Half the bet is given back, rounded down, and the dealer doesn't need to play the hand
+                    if (!engine().canSurrender()) { return false; }
+                    hand.outcome = SURRENDERED;
+                    hand.won = hand.bet / 2;
+                    nextHand();
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        // Writes everything about the shoe that carries over from one round to the next, and puts it back.
+        // Only valid between rounds
+        template <class Out> void save(Out& out) const { shoe.save(out); }
+        template <class In> bool restore(In& in) { return shoe.restore(in); }
+
+    protected:
+        RoundEngine(const Rules& tableRules, uint64_t seed) : rules(tableRules), shoe(tableRules, seed) {}
+
+        Engine& engine() { return static_cast<Engine&>(*this); }
+
+        // The dealer's face down card, while the players can't see it
+        const Card* faceDown() const { return phase == INSURANCE || phase == PLAYER_TURN ? &dealer[0] : nullptr; }
+
+        // Moves the next card from the shoe into a hand
+        void draw(HandView hand) { hand.add(shoe.draw()); }
+
+        void drawDealer() {
+            Card card = shoe.draw();
+            dealer.push_back(card);
+            dealerValue.add(card);
+            return;
+        }
+
+        // Places an insurance bet of up to half of the opening bet
+        void placeInsurance(RoundResult& result, int amount) {
+            amount = max(0, min(amount, result.bet / 2));
+            result.insurance = amount;
+            result.wagered += amount;
+
+            // Insurance pays 2:1 when the dealer has blackjack
+            if (amount > 0 && dealerValue.blackjack()) {
+                result.returned += 3 * amount;
+            }
+            return;
+        }
+
+        // The dealer checks for blackjack, but only peeks when showing an Ace or a ten
+        void peek() {
+            int up = upCard().value;
+            dealerBlackjack = (up == 1 || up >= 10) && dealerValue.blackjack();
+            return;
+        }
+
+        // Settles a hand right away if either side has a natural. Returns whether it was settled
+        bool settleNatural(HandView hand) {
+            bool playerBlackjack = hand.blackjack();
+
+            if (dealerBlackjack) {
+                // If the player and dealer both have blackjack, then it is a push
+                hand.outcome = playerBlackjack ? PUSH : LOSS;
+                hand.won = playerBlackjack ? hand.bet : 0;
+                return true;
+            }
+            if (playerBlackjack) {
+                // Any players that have blackjack are paid out immediately
+                hand.outcome = BLACKJACK;
+                hand.won = payout(hand.bet, 21, 2, rules.sixToFive);
+                return true;
+            }
+            return false;
+        }
+
+        // Moves on to the next hand of whoever's turn it is, or on from them once they have played every hand
+        void nextHand() {
+            current++;
+
+            // A freshly split hand that already has 21 needs no decision
+            while (current < engine().handCount() && engine().handView(current).total() == 21) {
+                current++;
+            }
+
+            if (current >= engine().handCount()) {
+                current = engine().handCount() - 1;
+                engine().handsPlayed();
+            }
+            return;
+        }
+
+        // The dealer draws until reaching 17 or more (or past a soft 17, if the rules say so), unless every
+        // hand in play has already busted or been surrendered
+        void dealerTurn() {
+            INSTRUMENT_STAGE(STAGE_DEALER);
+            bool anyStanding = false;
+            engine().forEachHandInPlay([&](HandView hand) { anyStanding |= hand.standing(); });
+
+            if (anyStanding) {
+                while (rules.dealerHits(dealerValue)) {
+                    drawDealer();
+                }
+            }
+            return;
+        }
+
+        // Pays out every hand in play against the dealer's final total
+        void settle() {
+            INSTRUMENT_STAGE(STAGE_SETTLE);
+            int dealerTotal = dealerValue.total();
+
+            engine().forEachHandInPlay([&](HandView hand) {
+                int total = hand.total();
+
+                if (hand.outcome == SURRENDERED) {
+                    return;
+                }
+                else if (hand.bust()) {
+                    hand.outcome = BUST;
+                }
+                else if (dealerTotal > 21 || total > dealerTotal) {
+                    hand.outcome = WIN;
+                    // Split hands that reach 21 in two cards are paid like any other win
+                    hand.won = payout(hand.bet, total, hand.fromSplit ? 0 : (int)hand.numCards, rules.sixToFive);
+                }
+                else if (total == dealerTotal) {
+                    hand.outcome = PUSH;
+                    hand.won = hand.bet;
+                }
+                else {
+                    hand.outcome = LOSS;
+                }
+            });
+
+            engine().finishRound();
+            return;
+        }
+
+        Rules rules;
+        DealingShoe shoe;               // The boot the dealer draws from
+
+        Hand dealer;                    // The dealer's hand. The first card is face down
+        HandValue dealerValue;
+        bool dealerBlackjack = false;
+
+        int current = 0;                // The hand being played by whoever's turn it is
+        Phase phase = BETTING;
+};
+
+// Plays rounds of blackjack against the dealer for a single player
+class Game : public RoundEngine<Game> {
+    public:
+        // Builds and shuffles the boot. The seed makes every shuffle of this game reproducible
+        Game(const Rules& tableRules = Rules(), uint64_t seed = 0) : RoundEngine(tableRules, seed) {}
+
+        // Takes the opening bet and deals two cards to the player and the dealer
+        void deal(int bet) {
+            INSTRUMENT_STAGE(STAGE_DEAL);
+            INSTRUMENT_COUNT(COUNT_ROUNDS, 1);
+            result = RoundResult();
+            result.bet = bet;
+            result.wagered = bet;
+
+            hands.reset();
+            hands.allocate().bet = bet;
+            current = 0;
+            dealer.clear();
+
+            // One card to the player, one face down to the dealer, then one more each
+            dealerValue = HandValue();
+            draw(hands[0]);
+            drawDealer();
+            draw(hands[0]);
+            drawDealer();
+
+            // If the dealer has an Ace, insurance can be placed before the dealer checks for blackjack
+            if (upCard().value == 1) {
+                phase = INSURANCE;
+                result.insuranceOdds = insuranceOdds();
+                return;
+            }
+
+            checkForBlackjack();
+            return;
+        }
+
+        // Places an insurance bet of up to half of the opening bet, then the dealer checks for blackjack
+        void insure(int amount) {
+            if (phase != INSURANCE) { return; }
+            INSTRUMENT_STAGE(STAGE_INSURANCE);
+            placeInsurance(result, amount);
+            checkForBlackjack();
+            return;
+        }
+
+        // Whether the current hand can be doubled down, split or surrendered
+        bool canDouble() const { return phase == PLAYER_TURN && rules.canDouble(hands[current].cards, hands[current].fromSplit); }
+        bool canSplit() const { return phase == PLAYER_TURN && rules.canSplit(hands[current].cards, hands.size()); }
+        bool canSurrender() const { return phase == PLAYER_TURN && rules.canSurrender(hands[current].cards, hands.size()); }
+
+        // Gathers the cards from the table and reshuffles the boot if the discard pile is full
+        void endRound() {
+            if (phase != ROUND_OVER) { return; }
+            result.reshuffled = shoe.endRound();
+            phase = BETTING;
+            return;
+        }
+
+        const RoundResult& getResult() const { return result; }
+
+        int handCount() const { return hands.size(); }
+        const PlayerHand& hand(int i) const { return hands[i]; }
+        const PlayerHand& hand() const { return hands[current]; }
+
+        // Every card dealt from the boot this round, in the order it was dealt. Valid until endRound()
+        const Card* roundCards() const { return shoe.roundCards(); }
+        int roundCardCount() const { return shoe.roundCardCount(); }
+        int shoePosition() const { return shoe.position(); }
+
+        // Deals the given cards in order, in place of the boot, until they run out. Used to replay a logged round
+        void scriptCards(const Card* cards, int count) { shoe.scriptCards(cards, count); }
+
+        // Replaces the boot with a shuffled order of the same cards, between rounds. Used with a shared boot
+        void loadShoe(const Card* order) {
+            if (phase == BETTING) { shoe.load(order); }
+        }
+
+    private:
+        friend class RoundEngine<Game>;
+
+        HandView handView(int i) { return hands[i]; }
+        HandView addHand() { return hands.allocate(); }
+        RoundResult& playerResult() { return result; }
+
+        // The player has played every hand, so the dealer plays and the round is settled
+        void handsPlayed() {
+            dealerTurn();
+            settle();
+            return;
+        }
+
+        template <class Visit>
+        void forEachHandInPlay(Visit visit) {
+            for (int i = 0; i < hands.size(); i++) { visit(hands[i]); }
+        }
+
+        // The dealer checks for blackjack. Naturals are settled right away, otherwise the player's turn begins
+        void checkForBlackjack() {
+            peek();
+            if (settleNatural(hands[0])) { finishRound(); }
+            else { phase = PLAYER_TURN; }
+            return;
+        }
+
+        // Totals the round up once every hand has been settled
+        void finishRound() {
+            result.numHands = hands.size();
+            result.dealerTotal = dealerValue.total();
+            result.dealerBlackjack = dealerBlackjack;
+
+            for (int i = 0; i < hands.size(); i++) {
+                result.outcomes[i] = hands[i].outcome;
+                result.returned += hands[i].won;
+            }
+
+            result.net = result.returned - result.wagered;
+            phase = ROUND_OVER;
+            return;
+        }
+
+        RoundArena hands;               // The player's hands, more than one after splitting
+        RoundResult result;
+};
+
+/**********************
+ * A policy is anything that can answer the three questions the engine asks:
+ *      - int bet(const Game&)           how much to bet on the next round
+ *      - int insurance(const Game&)     how much insurance to place when the dealer shows an Ace
+ *      - Action action(const Game&)     what to do with the current hand
+ *
+ * A Table asks the same questions of whichever seat's turn it is, so policies take either engine as a
+ * template. playRound() is a template so a simple policy is inlined straight into the loop.
+ **********************/
+
+// Whether a type answers the three questions a policy is asked by the given engine. Checked where a policy
+// is bound to an engine, so a policy missing an answer is one clear error instead of a page of them
+template <class Policy, class Engine, class = void>
+struct IsPolicy : false_type {};
+
+template <class Policy, class Engine>
+struct IsPolicy<Policy, Engine, void_t<decltype(int(declval<Policy&>().bet(declval<const Engine&>()))),
+                                       decltype(int(declval<Policy&>().insurance(declval<const Engine&>()))),
+                                       decltype(Action(declval<Policy&>().action(declval<const Engine&>())))>> : true_type {};
+
+// Plays one full round with the given policy and returns what happened
+template <class Policy>
+RoundResult playRound(Game& game, Policy& policy) {
+    static_assert(IsPolicy<Policy, Game>::value, "A policy needs bet(), insurance() and action() for a Game");
+    game.deal(policy.bet(game));
+
+    if (game.getPhase() == Game::INSURANCE) {
+        game.insure(policy.insurance(game));
+    }
+
+    while (game.getPhase() == Game::PLAYER_TURN) {
+        // Anything the engine won't allow is treated as a stand so the round always finishes
+        if (!game.act(policy.action(game))) {
+            game.act(STAND);
+        }
+    }
+
+    game.endRound();
+    return game.getResult();
+}
+
+// Plays like the dealer: the minimum bet, no insurance, and hit until reaching 17
+struct DealerPolicy {
+    template <class Engine> int bet(const Engine& game) { return game.getRules().minBet; }
+    template <class Engine> int insurance(const Engine&) { return 0; }
+    template <class Engine> Action action(const Engine& game) { return game.hand().value.total() < 17 ? HIT : STAND; }
+};
+
+// Plays the book move from the basic strategy chart for the table's rules, with the minimum bet and no insurance
+struct BookPolicy {
+    template <class Engine> int bet(const Engine& game) { return game.getRules().minBet; }
+    template <class Engine> int insurance(const Engine&) { return 0; }
+
+    template <class Engine>
+    Action action(const Engine& game) {
+        const PlayerHand& hand = game.hand();
+        return bookAction(basicStrategy(game.getRules()), hand.value, hand.cards[0], game.upCard(), game.canDouble(), game.canSplit(),
+                          game.canSurrender());
+    }
+};
+
+// A baseline to measure the others against: bets the minimum, never insures and makes any move the engine allows at random
+struct RandomPolicy {
+    Xoshiro256 gen;
+
+    RandomPolicy(uint64_t seed = 1) : gen(seed) {}
+
+    template <class Engine> int bet(const Engine& game) { return game.getRules().minBet; }
+    template <class Engine> int insurance(const Engine&) { return 0; }
+
+    template <class Engine>
+    Action action(const Engine& game) {
+        Action allowed[5] = { HIT, STAND };
+        int count = 2;
+        if (game.canDouble()) { allowed[count++] = DOUBLE; }
+        if (game.canSplit()) { allowed[count++] = SPLIT; }
+        if (game.canSurrender()) { allowed[count++] = SURRENDER; }
+        return allowed[bounded(gen, count)];
+    }
+
+    // The generator is the only state that carries over between rounds
+    template <class Out> void save(Out& out) const { out.write(gen); }
+    template <class In> bool restore(In& in) { return in.read(gen); }
+};
+
+// How much insurance the exact odds say to place: the most allowed, half the bet, when more than a third of the
+// unseen cards are tens, and none otherwise. Insurance is a side bet, so the hand it protects doesn't change the answer
+template <class Engine>
+int insuranceAdvice(const Engine& game) {
+    return game.insuranceOdds().worthTaking() ? game.getResult().bet / 2 : 0;
+}
+
+// Plays like another policy, but takes insurance whenever the exact odds say it pays, instead of by its own rule
+template <class Policy>
+struct ExactInsurance : Policy {
+    ExactInsurance(Policy policy) : Policy(std::move(policy)) {}
+
+    template <class Engine> int insurance(const Engine& game) { return insuranceAdvice(game); }
+};
+
+/**********************
+ * A table seats up to seven players against one dealer. Cards are dealt in casino order: one card to each
+ * seat in turn, one face down to the dealer, a second card to each seat and then the dealer's up card.
+ * Every seat plays out its hands in turn, the dealer plays once, and every hand is settled against the one
+ * dealer hand.
+ *
+ * A Table is driven like a Game. It asks whichever seat's turn it is to bet, insure and act, and answers
+ * the questions a policy asks of a Game for that seat, so the same policies can sit at either.
+ *
+ * The hands at the table are stored as structure-of-arrays: one array per field, indexed by hand slot,
+ * so the per-seat loops over totals, bets and outcomes walk contiguous memory. Seat s owns the MAX_HANDS
+ * slots starting at s * MAX_HANDS, and its split hands fill them in order.
+ **********************/
+
+// The most seats at a table
+const int MAX_SEATS = 7;
+
+// Hand slots for a full table, with every seat split as far as it can go
+const int MAX_TABLE_HANDS = MAX_SEATS * MAX_HANDS;
+
+// Plays rounds of blackjack against the dealer for every seat at a table
+class Table : public RoundEngine<Table> {
+    public:
+        // Builds and shuffles the boot for a table with the given number of seats taken
+        Table(const Rules& tableRules = Rules(), int seats = MAX_SEATS, uint64_t seed = 0)
+            : RoundEngine(tableRules, seed), numSeats(max(1, min(seats, MAX_SEATS))) {}
+
+        // Takes the opening bet for the seat whose turn it is. Once every seat has bet, the cards are dealt
+        void placeBet(int bet) {
+            if (phase != BETTING) { return; }
+
+            results[seat] = RoundResult();
+            results[seat].bet = bet;
+            results[seat].wagered = bet;
+
+            if (++seat == numSeats) { deal(); }
+            return;
+        }
+
+        // Places insurance for the seat whose turn it is. Once every seat has answered, the dealer checks for blackjack
+        void insure(int amount) {
+            if (phase != INSURANCE) { return; }
+            INSTRUMENT_STAGE(STAGE_INSURANCE);
+            placeInsurance(results[seat], amount);
+            if (++seat == numSeats) { checkForBlackjack(); }
+            return;
+        }
+
+        // Whether the current hand of the seat whose turn it is can be doubled down, split or surrendered
+        bool canDouble() const { return phase == PLAYER_TURN && rules.canDouble(cards[currentSlot()], fromSplit[currentSlot()]); }
+        bool canSplit() const { return phase == PLAYER_TURN && rules.canSplit(cards[currentSlot()], handsHeld[seat]); }
+        bool canSurrender() const { return phase == PLAYER_TURN && rules.canSurrender(cards[currentSlot()], handsHeld[seat]); }
+
+        // Gathers the cards from the table and reshuffles the boot if the discard pile is full
+        void endRound() {
+            if (phase != ROUND_OVER) { return; }
+
+            if (shoe.endRound()) {
+                for (int s = 0; s < numSeats; s++) { results[s].reshuffled = true; }
+            }
+
+            phase = BETTING;
+            seat = 0;
+            return;
+        }
+
+        int seatCount() const { return numSeats; }
+        int currentSeat() const { return seat; }
+        const RoundResult& getResult() const { return results[seat]; }
+        const RoundResult& getResult(int s) const { return results[s]; }
+
+        // The hands of the seat whose turn it is, put together from the table's arrays
+        int handCount() const { return handsHeld[seat]; }
+        PlayerHand hand(int i) const { return handAt(seat * MAX_HANDS + i); }
+        PlayerHand hand() const { return handAt(currentSlot()); }
+
+    private:
+        friend class RoundEngine<Table>;
+
+        int currentSlot() const { return seat * MAX_HANDS + current; }
+
+        // A hand slot's fields, for the rules to work on
+        HandView slotView(int slot) {
+            return HandView(cards[slot], hard[slot], ace[slot], numCards[slot], bets[slot], won[slot], doubled[slot], fromSplit[slot],
+                            outcomes[slot]);
+        }
+
+        HandView handView(int i) { return slotView(seat * MAX_HANDS + i); }
+        RoundResult& playerResult() { return results[seat]; }
+
+        // Hands the seat whose turn it is the next of its slots, for the second half of a split
+        HandView addHand() {
+            int slot = seat * MAX_HANDS + handsHeld[seat]++;
+            clearHand(slot);
+            return slotView(slot);
+        }
+
+        // Once a seat has played every hand, the turn passes on
+        void handsPlayed() { nextSeat(); }
+
+        // Every hand of every seat not settled before the players' turns
+        template <class Visit>
+        void forEachHandInPlay(Visit visit) {
+            for (int s = 0; s < numSeats; s++) {
+                if (finished[s]) { continue; }
+                for (int slot = s * MAX_HANDS; slot < s * MAX_HANDS + handsHeld[s]; slot++) { visit(slotView(slot)); }
+            }
+        }
+
+        PlayerHand handAt(int slot) const {
+            PlayerHand h;
+            h.cards = cards[slot];
+            h.value.hard = hard[slot];
+            h.value.ace = ace[slot];
+            h.value.numCards = numCards[slot];
+            h.bet = bets[slot];
+            h.doubled = doubled[slot];
+            h.fromSplit = fromSplit[slot];
+            h.outcome = outcomes[slot];
+            h.won = won[slot];
+            return h;
+        }
+
+        void clearHand(int slot) {
+            cards[slot].clear();
+            hard[slot] = 0;
+            ace[slot] = false;
+            numCards[slot] = 0;
+            bets[slot] = 0;
+            won[slot] = 0;
+            doubled[slot] = false;
+            fromSplit[slot] = false;
+            outcomes[slot] = PENDING;
+            return;
+        }
+
+        // Deals two cards to every seat and the dealer, one at a time around the table
+        void deal() {
+            INSTRUMENT_STAGE(STAGE_DEAL);
+            INSTRUMENT_COUNT(COUNT_ROUNDS, 1);
+            dealer.clear();
+            dealerValue = HandValue();
+
+            for (int s = 0; s < numSeats; s++) {
+                int slot = s * MAX_HANDS;
+                clearHand(slot);
+                bets[slot] = results[s].bet;
+                handsHeld[s] = 1;
+                finished[s] = false;
+            }
+
+            for (int s = 0; s < numSeats; s++) { draw(slotView(s * MAX_HANDS)); }
+            drawDealer();
+            for (int s = 0; s < numSeats; s++) { draw(slotView(s * MAX_HANDS)); }
+            drawDealer();
+
+            seat = 0;
+            current = 0;
+
+            // If the dealer has an Ace, every seat can place insurance before the dealer checks for blackjack.
+            // Every seat has seen the same cards, so they all get the same odds
+            if (upCard().value == 1) {
+                phase = INSURANCE;
+                InsuranceOdds odds = insuranceOdds();
+                for (int s = 0; s < numSeats; s++) { results[s].insuranceOdds = odds; }
+                return;
+            }
+
+            checkForBlackjack();
+            return;
+        }
+
+        // The dealer checks for blackjack. Naturals are settled right away, then the first seat with a decision
+        // to make starts its turn
+        void checkForBlackjack() {
+            peek();
+            for (int s = 0; s < numSeats; s++) { finished[s] = settleNatural(slotView(s * MAX_HANDS)); }
+
+            seat = -1;
+            current = 0;
+            phase = PLAYER_TURN;
+            nextSeat();
+            return;
+        }
+
+        // Passes the turn to the next seat that still has a hand to play, or to the dealer once there are none
+        void nextSeat() {
+            do { seat++; } while (seat < numSeats && finished[seat]);
+
+            if (seat < numSeats) {
+                current = 0;
+                return;
+            }
+
+            seat = numSeats - 1;
+            dealerTurn();
+            settle();
+            return;
+        }
+
+        // Totals the round up for every seat once every hand has been settled
+        void finishRound() {
+            for (int s = 0; s < numSeats; s++) {
+                RoundResult& result = results[s];
+                result.numHands = handsHeld[s];
+                result.dealerTotal = dealerValue.total();
+                result.dealerBlackjack = dealerBlackjack;
+
+                for (int i = 0; i < handsHeld[s]; i++) {
+                    result.outcomes[i] = outcomes[s * MAX_HANDS + i];
+                    result.returned += won[s * MAX_HANDS + i];
+                }
+
+                result.net = result.returned - result.wagered;
+            }
+
+            phase = ROUND_OVER;
+            return;
+        }
+
+        int numSeats;
+
+        // One entry per hand slot
+        Hand cards[MAX_TABLE_HANDS];
+        unsigned char hard[MAX_TABLE_HANDS];
+        bool ace[MAX_TABLE_HANDS];
+        unsigned char numCards[MAX_TABLE_HANDS];
+        int bets[MAX_TABLE_HANDS];
+        int won[MAX_TABLE_HANDS];
+        bool doubled[MAX_TABLE_HANDS];
+        bool fromSplit[MAX_TABLE_HANDS];
+        Outcome outcomes[MAX_TABLE_HANDS];
+
+        // One entry per seat
+        int handsHeld[MAX_SEATS] = {};
+        bool finished[MAX_SEATS] = {};  // Settled before the players' turns, by a natural on either side
+        RoundResult results[MAX_SEATS];
+
+        int seat = 0;                   // The seat whose turn it is
+};
+
+// Plays one full round at a table, with the same policy answering for every seat. The policy can tell the
+// seats apart with currentSeat()
+template <class Policy>
+void playRound(Table& table, Policy& policy) {
+    static_assert(IsPolicy<Policy, Table>::value, "A policy needs bet(), insurance() and action() for a Table");
+    while (table.getPhase() == Table::BETTING) {
+        table.placeBet(policy.bet(table));
+    }
+
+    while (table.getPhase() == Table::INSURANCE) {
+        table.insure(policy.insurance(table));
+    }
+
+    while (table.getPhase() == Table::PLAYER_TURN) {
+        // Anything the engine won't allow is treated as a stand so the round always finishes
+        if (!table.act(policy.action(table))) {
+            table.act(STAND);
+        }
+    }
+
+    table.endRound();
+    return;
+}
+
+/**********************
+ * Card counting. A counting system gives every card a tag, and the running count is the sum of the tags
+ * of the cards that have been seen. The shoe already keeps how many of each card are left as cards are
+ * dealt, so the count is read straight from that: the tags of everything seen are the tags of the whole
+ * boot minus the tags of what hasn't been seen. Nothing extra happens per card, and reading the count is
+ * the same ten multiplications however far into the shoe the game is.
+ *
+ * Systems are picked at compile time as a TagTable, so the tags are constants in the loop.
+ **********************/
+
+// A counting system's tag for each card value. Any set of tags can be used as a system of its own
+template <int Ace, int Two, int Three, int Four, int Five, int Six, int Seven, int Eight, int Nine, int Ten>
+struct TagTable {
+    static constexpr int tags[11] = { 0, Ace, Two, Three, Four, Five, Six, Seven, Eight, Nine, Ten };
+
+    // How much the count rises over a whole deck. Zero for a balanced count
+    static constexpr int imbalance = 4 * (Ace + Two + Three + Four + Five + Six + Seven + Eight + Nine) + 16 * Ten;
+
+    // The true count at which insurance is worth taking
+    static constexpr double insuranceAt = 3.0;
+};
+
+struct HiLo : TagTable<-1, 1, 1, 1, 1, 1, 0, 0, 0, -1> {
+    static constexpr const char* name = "Hi-Lo";
+};
+
+// Knock-Out is unbalanced, so its running count starts below zero and works without dividing by the decks left
+struct KnockOut : TagTable<-1, 1, 1, 1, 1, 1, 1, 0, 0, -1> {
+    static constexpr const char* name = "KO";
+};
+
+// Omega II leaves Aces out and counts some cards twice, so its counts run about twice as high as Hi-Lo
+struct OmegaII : TagTable<0, 1, 1, 2, 2, 2, 1, 0, -1, -2> {
+    static constexpr const char* name = "Omega II";
+    static constexpr double insuranceAt = 6.0;
+};
+
+// Reads the count for a system from the cards the player hasn't seen
+template <class System>
+class CardCounter {
+    public:
+        CardCounter(int boots = 4) : numDecks(boots) {}
+
+        // The running count, starting from the system's usual starting count
+        int runningCount(const Composition& unseen) const {
+            return startingCount() + seenTags(unseen);
+        }
+
+        // The count per deck left to deal. Unbalanced counts are first corrected for how far they rise on their own
+        double trueCount(const Composition& unseen) const {
+            int seen = 52 * numDecks - unseen.total;
+            double balanced = seenTags(unseen) - (double)System::imbalance * seen / 52.0;
+            double decksLeft = max(unseen.total, 13) / 52.0;
+
+            return balanced / decksLeft;
+        }
+
+        // Unbalanced counts start low enough to reach the same point as a balanced count near the end of the shoe
+        int startingCount() const { return System::imbalance == 0 ? 0 : System::imbalance * (1 - numDecks); }
+
+    private:
+        // The sum of the tags of every card that has been seen
+        int seenTags(const Composition& unseen) const {
+            int tags = System::imbalance * numDecks;
+            for (int points = 1; points <= 10; points++) {
+                tags -= System::tags[points] * unseen.counts[points];
+            }
+            return tags;
+        }
+
+        int numDecks;
+};
+
+// Bets more as the true count rises: one unit at a count of 1 or less, then 2, 4, 6 and 8 units at 2, 3, 4 and 5+
+struct BetSpread {
+    int units[6] = { 1, 1, 2, 4, 6, 8 };   // [true count, from 0 to 5 or more]
+
+    int bet(double trueCount, const Rules& rules) const {
+        int index = max(0, min(5, (int)trueCount));
+        return min(rules.maxBet, rules.minBet * units[index]);
+    }
+};
+
+// Counts cards with the given system, spreads its bets by the true count, takes insurance when the count
+// says it is worth it, and otherwise plays the book moves
+template <class System>
+struct CountingPolicy {
+    CardCounter<System> counter;
+    BetSpread spread;
+
+    CountingPolicy(const Rules& rules = Rules()) : counter(rules.numDecks) {}
+
+    template <class Engine>
+    int bet(const Engine& game) {
+        return spread.bet(counter.trueCount(game.unseen()), game.getRules());
+    }
+
+    template <class Engine>
+    int insurance(const Engine& game) {
+        return counter.trueCount(game.unseen()) >= System::insuranceAt ? game.getResult().bet / 2 : 0;
+    }
+
+    template <class Engine>
+    Action action(const Engine& game) {
+        const PlayerHand& hand = game.hand();
+        return bookAction(basicStrategy(game.getRules()), hand.value, hand.cards[0], game.upCard(), game.canDouble(), game.canSplit(),
+                          game.canSurrender());
+    }
+};
+
+// Reads a "--name=value" or "--name value" option from the command line as text
+string argText(int argc, char* argv[], const string& name, const string& fallback) {
+    string flag = "--" + name;
+
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == flag && i + 1 < argc) {
+            return argv[i + 1];
+        }
+        if (arg.compare(0, flag.size() + 1, flag + "=") == 0) {
+            return arg.substr(flag.size() + 1);
+        }
+    }
+
+    return fallback;
+}
+
+// Checks whether a "--name" flag was given on the command line
+bool hasFlag(int argc, char* argv[], const string& name) {
+    for (int i = 2; i < argc; i++) {
+        if (argv[i] == "--" + name) { return true; }
+    }
+    return false;
+}
+
+// Reads a "--name=value" or "--name value" option from the command line as a number
+long long argValue(int argc, char* argv[], const string& name, long long fallback) {
+    string text = argText(argc, argv, name, "");
+    return text.empty() ? fallback : atoll(text.c_str());
+}
+
+// Reads a comma separated option from the command line as a list of values, e.g. "--decks 1,2,6"
+vector<string> argList(int argc, char* argv[], const string& name, const string& fallback) {
+    string text = argText(argc, argv, name, fallback);
+    vector<string> values;
+
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = min(text.find(',', start), text.size());
+        if (end > start) { values.push_back(text.substr(start, end - start)); }
+        start = end + 1;
+    }
+
+    return values;
+}
+
+// The house rules that can be set on the command line, in the order they are applied, with the values
+// that give the usual Rules(). Penetration is the share of the boot dealt before the cut card comes out,
+// so it is set after the number of decks
+const int NUM_RULE_OPTIONS = 6;
+const char* const RULE_OPTIONS[NUM_RULE_OPTIONS] = { "decks", "payout", "penetration", "h17", "das", "surrender" };
+const char* const RULE_DEFAULTS[NUM_RULE_OPTIONS] = { "4", "3:2", "0.77", "0", "1", "0" };
+
+// Sets one house rule from the text of its option
+void setRule(Rules& rules, const string& name, const string& value) {
+    if (name == "decks") { rules.numDecks = max(1, min(atoi(value.c_str()), 8)); }
+    else if (name == "payout") { rules.sixToFive = (value == "6:5"); }
+    // The cut card is kept far enough from the end that rounds don't run the boot dry
+    else if (name == "penetration") { rules.reshuffleAt = (int)(52 * rules.numDecks * max(0.1, min(atof(value.c_str()), 0.9))); }
+    else if (name == "h17") { rules.hitSoft17 = atoi(value.c_str()) != 0; }
+    else if (name == "das") { rules.doubleAfterSplit = atoi(value.c_str()) != 0; }
+    else if (name == "surrender") { rules.surrender = atoi(value.c_str()) != 0; }
+    return;
+}
+
+// Reads the house rules from the command line, e.g. "--decks 6 --payout 6:5 --h17 1"
+Rules rulesFromArgs(int argc, char* argv[]) {
+    Rules rules;
+    for (int i = 0; i < NUM_RULE_OPTIONS; i++) {
+        setRule(rules, RULE_OPTIONS[i], argText(argc, argv, RULE_OPTIONS[i], RULE_DEFAULTS[i]));
+    }
+    return rules;
+}
+
+// A short name for a set of house rules, e.g. "6D 3:2 75% H17 DAS LS"
+string ruleName(const Rules& rules) {
+    return to_string(rules.numDecks) + "D " + (rules.sixToFive ? "6:5 " : "3:2 ")
+        + to_string((int)(100.0 * rules.reshuffleAt / (52 * rules.numDecks) + 0.5)) + "% "
+        + (rules.hitSoft17 ? "H17 " : "S17 ") + (rules.doubleAfterSplit ? "DAS " : "NDAS ") + (rules.surrender ? "LS" : "NS");
+}
+
+/**********************
+ * Hand history. Every round a worker plays can be written to a log as fixed-width 32 byte records, so
+ * billions of hands can be kept on disk and read back without holding them in memory. A record holds the
+ * bet, the insurance and the chips won or lost, the cards in the order they left the shoe and the actions
+ * in the order they were taken. That is enough to replay the round through the engine, which puts every card back in the hand
+ * it went to. A round with more cards and actions than fit in one record carries on in the records
+ * that follow it.
+ *
+ * Records are gathered in a buffer for each worker. Full buffers are handed to a writer thread, which
+ * appends them to the file while the worker carries on with an empty one, so a worker only pays for a copy
+ * per round. If the disk falls behind, workers wait once a few buffers are queued instead of piling them
+ * up in memory. A worker never splits a round between two buffers, so a round's records always sit
+ * together even when several workers share a file. Rounds are replayed on their own, so it doesn't matter
+ * how the workers' rounds are interleaved.
+ *
+ * The log is read back by mapping the file into memory and handing the records to a callback straight
+ * from the mapping. Numbers are stored in the machine's byte order.
+ **********************/
+
+// The first 64 bytes of a log: what it is, and the rules the rounds in it were played under
+struct HandLogHeader {
+    char magic[4] = { 'B', 'J', 'H', 'L' };
+    uint32_t version = 1;
+    uint32_t recordSize = 32;
+    int32_t numDecks = 0, minBet = 0, maxBet = 0, reshuffleAt = 0, maxHands = 0;
+    uint8_t doubleAfterSplit = 0, shuffle = 0, hitSoft17 = 0, surrender = 0;
+    uint64_t seed = 0;                  // The master seed the workers' seeds were made from
+    uint8_t sixToFive = 0;
+    uint8_t padding[15] = {};
+};
+
+static_assert(sizeof(HandLogHeader) == 64, "The log header should be 64 bytes");
+
+// Where to write a log that is thrown away
+#ifdef _WIN32
+const char* const NULL_DEVICE = "NUL";
+#else
+const char* const NULL_DEVICE = "/dev/null";
+#endif
+
+// A record that only holds the events that didn't fit in the record before it
+const uint8_t LOG_CONTINUATION = 1;
+
+// How many event bytes fit in one record
+const int LOG_EVENTS = 13;
+const size_t LOG_BUFFER_RECORDS = 1 << 12;     // Records a worker gathers before handing them to the writer
+
+// One round, or the rest of one. The events are the round's cards, one byte each as a Card, followed by
+// its actions, one byte each as an Action. Most rounds fit in a single record
+struct HandRecord {
+    uint32_t round;             // The round's number for the worker that played it, counting from 0
+    uint16_t stream;            // The worker that played it. Its seed is streamSeed(seed, stream)
+    uint16_t shoePosition;      // Where in the boot the round's first card was dealt from
+    uint16_t bet;
+    uint16_t insurance;
+    int32_t net;                // Chips won or lost over the round, including insurance
+    uint8_t numCards;           // Cards dealt over the whole round
+    uint8_t numActions;         // Actions taken over the whole round
+    uint8_t flags;
+    uint8_t events[LOG_EVENTS];
+};
+
+static_assert(sizeof(HandRecord) == 32, "A hand record should be 32 bytes");
+static_assert(sizeof(Card) == 1, "Cards are logged as single bytes");
+
+// The file the workers' records are appended to. Buffers can be handed over from any thread, and are written
+// out in the order they arrive by a thread of the file's own
+class HandLogFile {
+    public:
+        ~HandLogFile() { close(); }
+
+        // Creates the file, writes its header and starts the writer thread. Returns false if it can't be created
+        bool open(const string& path, const Rules& rules, uint64_t seed) {
+            file = fopen(path.c_str(), "wb");
+            if (!file) { return false; }
+
+            // Records arrive in large buffers already, so they go straight to the file
+            setvbuf(file, nullptr, _IONBF, 0);
+
+            HandLogHeader header;
+            header.numDecks = rules.numDecks;
+            header.minBet = rules.minBet;
+            header.maxBet = rules.maxBet;
+            header.reshuffleAt = rules.reshuffleAt;
+            header.maxHands = rules.maxHands;
+            header.doubleAfterSplit = rules.doubleAfterSplit;
+            header.hitSoft17 = rules.hitSoft17;
+            header.surrender = rules.surrender;
+            header.sixToFive = rules.sixToFive;
+            header.shuffle = rules.shuffle;
+            header.seed = seed;
+            fwrite(&header, sizeof(header), 1, file);
+
+            // Every buffer the workers will swap in is made up front, so logging never touches the heap
+            spares.assign(MAX_QUEUED + 1, vector<HandRecord>(LOG_BUFFER_RECORDS));
+
+            stopping = false;
+            writer = thread([this]() { writeQueued(); });
+            return true;
+        }
+
+        // Queues the first 'count' records of a buffer to be written and swaps in a written buffer to fill next.
+        // Waits if too many buffers are queued or none have been written yet
+        void append(vector<HandRecord>& records, size_t count) {
+            unique_lock<mutex> lock(guard);
+            roomLeft.wait(lock, [this]() { return numQueued < MAX_QUEUED; });
+
+            Queued& next = queued[(firstQueued + numQueued++) % MAX_QUEUED];
+            next.records = move(records);
+            next.count = count;
+            workWaiting.notify_one();
+
+            roomLeft.wait(lock, [this]() { return !spares.empty(); });
+            records = move(spares.back());
+            spares.pop_back();
+            return;
+        }
+
+        // Writes out everything queued and closes the file
+        void close() {
+            if (!file) { return; }
+
+            {
+                lock_guard<mutex> lock(guard);
+                stopping = true;
+            }
+            workWaiting.notify_one();
+            writer.join();
+
+            fclose(file);
+            file = nullptr;
+            return;
+        }
+
+    private:
+        static const size_t MAX_QUEUED = 8;
+
+        void writeQueued() {
+            unique_lock<mutex> lock(guard);
+
+            while (true) {
+                workWaiting.wait(lock, [this]() { return stopping || numQueued > 0; });
+                if (numQueued == 0) { return; }
+
+                Queued next = move(queued[firstQueued]);
+                firstQueued = (firstQueued + 1) % MAX_QUEUED;
+                numQueued--;
+                roomLeft.notify_all();
+
+                // The disk is written without holding the lock, so workers can keep queueing
+                lock.unlock();
+                fwrite(next.records.data(), sizeof(HandRecord), next.count, file);
+                lock.lock();
+
+                spares.push_back(move(next.records));
+                roomLeft.notify_all();
+            }
+        }
+
+        struct Queued {
+            vector<HandRecord> records;
+            size_t count;
+        };
+
+        FILE* file = nullptr;
+        thread writer;
+        mutex guard;
+        condition_variable workWaiting, roomLeft;
+        Queued queued[MAX_QUEUED];     // Buffers waiting to be written, in a ring
+        size_t firstQueued = 0, numQueued = 0;
+        vector<vector<HandRecord>> spares;     // Written buffers, kept to be filled again
+        bool stopping = false;
+};
+
+// Gathers one worker's records and appends them to the log a buffer at a time
+class HandLogWriter {
+    public:
+        HandLogWriter(HandLogFile& logFile, int workerStream)
+            : file(logFile), stream(workerStream), buffer(LOG_BUFFER_RECORDS) {}
+
+        ~HandLogWriter() { flush(); }
+
+        // Notes an action taken in the current round
+        void action(Action taken) {
+            if (numActions < 255) { actions[numActions++] = taken; }
+        }
+
+        // Records a round that has been played to the end but not yet gathered up with endRound(), along with
+        // the actions noted since the last round
+        void write(const Game& game) {
+            int numCards = min(game.roundCardCount(), 255);
+            int numEvents = numCards + numActions;
+            size_t needed = 1 + max(0, numEvents - 1) / LOG_EVENTS;
+
+            // Keep the round's records together
+            if (used + needed > LOG_BUFFER_RECORDS) { flush(); }
+
+            HandRecord& head = buffer[used];
+            if (numEvents <= LOG_EVENTS) {
+                writeShortEvents(game, head, numCards, numEvents);
+            }
+            else {
+                writeLongEvents(game, head, numCards, numEvents);
+            }
+
+            const RoundResult& result = game.getResult();
+            head.round = round++;
+            head.stream = stream;
+            head.shoePosition = game.shoePosition();
+            head.bet = result.bet;
+            head.insurance = result.insurance;
+            head.net = result.net;
+            head.numCards = numCards;
+            head.numActions = numActions;
+            head.flags = 0;
+
+            used += needed;
+            numActions = 0;
+            return;
+        }
+
+        void flush() {
+            if (used > 0) { file.append(buffer, used); }
+            used = 0;
+            return;
+        }
+
+    private:
+        // Most rounds fit in one record, with the cards and then the actions copied straight into it
+        void writeShortEvents(const Game& game, HandRecord& head, int numCards, int numEvents) {
+            int cardBytes = min(numCards, LOG_EVENTS);
+            int actionBytes = min(numEvents - cardBytes, LOG_EVENTS - cardBytes);
+            memcpy(head.events, game.roundCards(), cardBytes);
+            memcpy(head.events + cardBytes, actions, actionBytes);
+            memset(head.events + cardBytes + actionBytes, 0, LOG_EVENTS - cardBytes - actionBytes);
+        }
+
+        // The events run on from one record into the next
+        void writeLongEvents(const Game& game, HandRecord& head, int numCards, int numEvents) {
+            uint8_t events[2 * 255 + LOG_EVENTS] = {};
+            memcpy(events, game.roundCards(), numCards);
+            memcpy(events + numCards, actions, numActions);
+
+            memcpy(head.events, events, LOG_EVENTS);
+            for (int written = LOG_EVENTS, next = used + 1; written < numEvents; written += LOG_EVENTS, next++) {
+                HandRecord& continued = buffer[next];
+                continued = HandRecord();
+                continued.round = round;
+                continued.stream = stream;
+                continued.flags = LOG_CONTINUATION;
+                memcpy(continued.events, events + written, LOG_EVENTS);
+            }
+        }
+
+        HandLogFile& file;
+        int stream;
+        uint32_t round = 0;
+        vector<HandRecord> buffer;
+        size_t used = 0;
+        uint8_t actions[255] = {};
+        int numActions = 0;
+};
+
+// Plays one round like playRound() and writes it to the log before the cards are gathered up
+template <class Policy>
+RoundResult playRound(Game& game, Policy& policy, HandLogWriter& log) {
+    game.deal(policy.bet(game));
+
+    if (game.getPhase() == Game::INSURANCE) {
+        game.insure(policy.insurance(game));
+    }
+
+    while (game.getPhase() == Game::PLAYER_TURN) {
+        // The action that was actually applied is the one logged
+        Action action = policy.action(game);
+        if (!game.act(action)) {
+            action = STAND;
+            game.act(STAND);
+        }
+        log.action(action);
+    }
+
+    log.write(game);
+    game.endRound();
+    return game.getResult();
+}
+
+// Reads a log by mapping it into memory. Records are handed out straight from the mapping
+class HandLogReader {
+    public:
+        HandLogReader() = default;
+        HandLogReader(const HandLogReader&) = delete;
+        HandLogReader& operator=(const HandLogReader&) = delete;
+        ~HandLogReader() { close(); }
+
+        // Maps the file and checks its header. Returns false if it isn't a log this version can read
+        bool open(const string& path) {
+            close();
+
+#ifdef _WIN32
+            // No mmap here, so the file is read into memory instead
+            FILE* file = fopen(path.c_str(), "rb");
+            if (!file) { return false; }
+            fseek(file, 0, SEEK_END);
+            contents.resize(ftell(file));
+            fseek(file, 0, SEEK_SET);
+            length = fread(contents.data(), 1, contents.size(), file);
+            fclose(file);
+            data = contents.data();
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) { return false; }
+
+            struct stat info;
+            if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(HandLogHeader)) {
+                ::close(fd);
+                return false;
+            }
+
+            length = info.st_size;
+            void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (mapped == MAP_FAILED) {
+                length = 0;
+                return false;
+            }
+
+            // Records are read from front to back
+            madvise(mapped, length, MADV_SEQUENTIAL);
+            data = static_cast<const unsigned char*>(mapped);
+#endif
+
+            const HandLogHeader& h = header();
+            if (length < sizeof(HandLogHeader) || memcmp(h.magic, "BJHL", 4) != 0 || h.version != 1 || h.recordSize != sizeof(HandRecord)) {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        void close() {
+#ifndef _WIN32
+            if (data) { munmap(const_cast<unsigned char*>(data), length); }
+#endif
+            data = nullptr;
+            length = 0;
+        }
+
+        const HandLogHeader& header() const { return *reinterpret_cast<const HandLogHeader*>(data); }
+
+        // The rules the log was written under
+        Rules rules() const {
+            Rules r;
+            r.numDecks = header().numDecks;
+            r.minBet = header().minBet;
+            r.maxBet = header().maxBet;
+            r.reshuffleAt = header().reshuffleAt;
+            r.maxHands = header().maxHands;
+            r.doubleAfterSplit = header().doubleAfterSplit;
+            r.hitSoft17 = header().hitSoft17;
+            r.surrender = header().surrender;
+            r.sixToFive = header().sixToFive;
+            r.shuffle = (ShuffleMode)header().shuffle;
+            return r;
+        }
+
+        const HandRecord* begin() const { return reinterpret_cast<const HandRecord*>(data + sizeof(HandLogHeader)); }
+        const HandRecord* end() const { return begin() + (length - sizeof(HandLogHeader)) / sizeof(HandRecord); }
+
+        // Calls callback(record, events) for every round, where 'events' holds the round's cards and then its
+        // actions. Events are read straight from the mapping unless the round spills into more records
+        template <class Callback>
+        void forEachRound(Callback callback) const {
+            uint8_t spilled[2 * 256];
+
+            for (const HandRecord* record = begin(); record < end(); ) {
+                const HandRecord& head = *record++;
+                int numEvents = head.numCards + head.numActions;
+
+                if (numEvents <= LOG_EVENTS) {
+                    callback(head, head.events);
+                    continue;
+                }
+
+                memcpy(spilled, head.events, LOG_EVENTS);
+                for (int copied = LOG_EVENTS; copied < numEvents && record < end(); copied += LOG_EVENTS) {
+                    memcpy(spilled + copied, record->events, min(LOG_EVENTS, numEvents - copied));
+                    record++;
+                }
+                callback(head, spilled);
+            }
+            return;
+        }
+
+    private:
+        const unsigned char* data = nullptr;
+        size_t length = 0;
+#ifdef _WIN32
+        vector<unsigned char> contents;
+#endif
+};
+
+// Plays a logged round again through a game, dealing the logged cards and taking the logged actions
+const RoundResult& replayRound(Game& game, const HandRecord& record, const uint8_t* events) {
+    Card cards[256];
+    int numCards = min<int>(record.numCards, 256);
+    memcpy(cards, events, numCards);
+
+    game.scriptCards(cards, numCards);
+    game.deal(record.bet);
+
+    if (game.getPhase() == Game::INSURANCE) {
+        game.insure(record.insurance);
+    }
+
+    const uint8_t* actions = events + record.numCards;
+    for (int i = 0; i < record.numActions && game.getPhase() == Game::PLAYER_TURN; i++) {
+        game.act((Action)actions[i]);
+    }
+
+    game.scriptCards(nullptr, 0);
+    game.endRound();
+    return game.getResult();
+}
+
+/**********************
+ * Simulations are split across threads. Every worker owns its own Game, and with it its own shoe and its
+ * own random generator. The worker generators are seeded from one master seed using SplitMix64, so the
+ * streams don't overlap and the same seed always deals the same cards. Workers only write to their own
+ * result, and the results are merged in worker order once every thread has finished.
+ *
+ * Results are streamed: everything a run keeps takes the same memory after a thousand hands as after a
+ * billion, and merges across threads. The net chips per round keep a running mean and variance (Welford's
+ * method, with Chan's formula to fold in exact sums of blocks of rounds and to merge), and the rounds are cut into sessions whose results go into a
+ * quantile sketch. A session also remembers its low point, to count the sessions that would have lost a
+ * whole bankroll.
+ *
+ * A run can stop early once the edge is known well enough. The workers check in after every chunk of rounds,
+ * and the last one to arrive merges everyone's results in worker order and decides whether to carry on, so
+ * the same seed and thread count always stop after the same hand.
+ **********************/
+
+// The seed for one stream (a worker, a shard, a shoe...) derived from the master seed
+uint64_t streamSeed(uint64_t masterSeed, uint64_t stream) {
+    uint64_t state = masterSeed;
+    uint64_t base = splitMix64(state);
+    state = base ^ (stream * 0xD1B54A32D192ED03ULL);
+    return splitMix64(state);
+}
+
+// A running count, mean and variance, updated one value at a time with Welford's method
+struct RunningStats {
+    long long count = 0;
+    double mean = 0.0;
+    double m2 = 0.0;        // Sum of squared differences from the mean
+
+    void add(double x) {
+        count++;
+        double delta = x - mean;
+        mean += delta / count;
+        m2 += delta * (x - mean);
+    }
+
+    // Combines two sets of values with Chan's formula
+    void merge(const RunningStats& other) {
+        if (other.count == 0) { return; }
+        long long total = count + other.count;
+        double delta = other.mean - mean;
+
+        mean += delta * other.count / total;
+        m2 += other.m2 + delta * delta * ((double)count * other.count / total);
+        count = total;
+    }
+
+    double variance() const { return count > 1 ? m2 / (count - 1) : 0.0; }
+    double stddev() const { return sqrt(variance()); }
+
+    // The standard error of the mean
+    double error() const { return count > 1 ? sqrt(variance() / count) : 0.0; }
+};
+
+// Running stats for chip counts, which are whole numbers. Values are summed exactly in blocks, and each
+// block is folded into the running mean and variance with Chan's formula. That keeps Welford's accuracy
+// over billions of values without a division for every one
+class ChipStats {
+    public:
+        void add(long long x) {
+            blockCount++;
+            blockSum += x;
+            blockSquares += x * x;
+            if (blockCount == BLOCK) { fold(); }
+        }
+
+        void merge(const ChipStats& other) {
+            fold();
+            folded.merge(other.stats());
+        }
+
+        // The stats of every value added so far
+        RunningStats stats() const {
+            RunningStats all = folded;
+            all.merge(block());
+            return all;
+        }
+
+    private:
+        static const long long BLOCK = 4096;
+
+        RunningStats block() const {
+            RunningStats b;
+            if (blockCount == 0) { return b; }
+            b.count = blockCount;
+            b.mean = (double)blockSum / blockCount;
+            b.m2 = (double)(blockSquares * blockCount - blockSum * blockSum) / blockCount;
+            return b;
+        }
+
+        void fold() {
+            folded.merge(block());
+            blockCount = blockSum = blockSquares = 0;
+        }
+
+        RunningStats folded;
+        long long blockCount = 0, blockSum = 0, blockSquares = 0;
+};
+
+// An approximate quantile sketch in constant memory. Values are counted in buckets whose bounds grow by 2%
+// at a time, on both sides of zero, so a quantile comes back within 1% of the value it stands for. Sketches
+// merge by adding up their buckets, so merging is exact. Values beyond about 600 million either way are
+// counted in the end buckets
+class QuantileSketch {
+    public:
+        void add(double x) {
+            count++;
+            if (x == 0) { zeros++; return; }
+            (x > 0 ? positive : negative)[bucket(fabs(x))]++;
+        }
+
+        void merge(const QuantileSketch& other) {
+            count += other.count;
+            zeros += other.zeros;
+            for (int i = 0; i < BUCKETS; i++) {
+                positive[i] += other.positive[i];
+                negative[i] += other.negative[i];
+            }
+        }
+
+        // The value with a share q of the values below it, for q from 0 to 1
+        double quantile(double q) const {
+            if (count == 0) { return 0.0; }
+            long long rank = (long long)(max(0.0, min(q, 1.0)) * (count - 1));
+
+            // From the most negative bucket up to the most positive
+            for (int i = BUCKETS - 1; i >= 0; i--) {
+                rank -= negative[i];
+                if (rank < 0) { return -value(i); }
+            }
+            rank -= zeros;
+            if (rank < 0) { return 0.0; }
+            for (int i = 0; i < BUCKETS; i++) {
+                rank -= positive[i];
+                if (rank < 0) { return value(i); }
+            }
+            return value(BUCKETS - 1);
+        }
+
+        long long size() const { return count; }
+
+    private:
+        static const int BUCKETS = 1024;
+        static constexpr double GROWTH = 1.02;
+
+        // Bucket i holds sizes above GROWTH^(i - 1) up to GROWTH^i
+        static int bucket(double size) {
+            return max(0, min(BUCKETS - 1, (int)ceil(log(size) / log(GROWTH))));
+        }
+
+        // The size that stands for a bucket, which is within 1% of anything in it
+        static double value(int i) { return 2.0 * pow(GROWTH, i) / (GROWTH + 1.0); }
+
+        long long count = 0, zeros = 0;
+        long long positive[BUCKETS] = {}, negative[BUCKETS] = {};
+};
+
+// Every seat's rounds cut into back to back sessions of a fixed length
+struct SessionStats {
+    int length = 0;                 // Rounds per session. Sessions aren't kept when this is 0
+    long long bankroll = 0;         // The chips a player brings to a session
+    long long played = 0;           // Finished sessions, over every seat
+    long long ruined = 0;           // Sessions that were down the whole bankroll at some point
+    QuantileSketch results;         // Net chips at the end of each finished session
+
+    // The sessions under way. Unfinished sessions are left out when results are merged
+    int roundsPlayed = 0;
+    int seats = 0;
+    long long net[MAX_SEATS] = {}, low[MAX_SEATS] = {};
+
+    void add(long long roundNet, int seat) {
+        net[seat] += roundNet;
+        low[seat] = min(low[seat], net[seat]);
+        seats = max(seats, seat + 1);
+    }
+
+    void endRound() {
+        if (++roundsPlayed < length) { return; }
+
+        for (int s = 0; s < seats; s++) {
+            played++;
+            ruined += low[s] <= -bankroll;
+            results.add(net[s]);
+            net[s] = low[s] = 0;
+        }
+        roundsPlayed = 0;
+    }
+
+    void merge(const SessionStats& other) {
+        played += other.played;
+        ruined += other.ruined;
+        results.merge(other.results);
+    }
+};
+
+// Totals from a simulation run. The counts are integers, so merging them is exact, and the running stats are
+// merged in worker order, so the same seed and thread count always give the same answers
+struct SimResult {
+    long long hands = 0;
+    long long wagered = 0;
+    long long net = 0;
+    long long wins = 0, losses = 0, pushes = 0, blackjacks = 0, surrenders = 0;
+    long long rounds = 0, reshuffles = 0;   // Rounds dealt, with one hand per seat, and how many ended in a reshuffle
+    long long seatWagered[MAX_SEATS] = {}, seatNet[MAX_SEATS] = {};
+    ChipStats roundNet;             // Net chips of each seat's round
+    SessionStats sessions;
+
+    // Every time insurance was offered, what insuring for half the bet by the exact odds would have won over never
+    // insuring. Insurance doesn't change the cards, so this is known whatever the policy did
+    long long insuranceOffers = 0, insuranceAdvised = 0;
+    double insuranceExpected = 0.0;     // The chips it wins on average, from the odds when it was offered
+    long long insuranceWon = 0;         // The chips it actually won
+    long long insuranceNet = 0;         // The chips won on the insurance the policy really placed
+
+    // Adds one seat's hand from a round
+    void add(const RoundResult& round, int seat = 0) {
+        hands++;
+        wagered += round.wagered;
+        net += round.net;
+        seatWagered[seat] += round.wagered;
+        seatNet[seat] += round.net;
+        roundNet.add(round.net);
+        if (sessions.length > 0) { sessions.add(round.net, seat); }
+
+        if (round.insuranceOdds.cards > 0) {
+            insuranceOffers++;
+            if (round.insuranceOdds.worthTaking()) {
+                int stake = round.bet / 2;
+                insuranceAdvised++;
+                insuranceExpected += stake * round.insuranceOdds.ev();
+                insuranceWon += round.dealerBlackjack ? 2 * stake : -stake;
+            }
+            insuranceNet += round.dealerBlackjack ? 2 * round.insurance : -round.insurance;
+        }
+
+        for (int i = 0; i < round.numHands; i++) {
+            switch (round.outcomes[i]) {
+                case BLACKJACK: blackjacks++; break;
+                case WIN: wins++; break;
+                case PUSH: pushes++; break;
+                case SURRENDERED: surrenders++; break;
+                default: losses++; break;
+            }
+        }
+    }
+
+    // Counts a round once every seat's hand has been added
+    void endRound(bool reshuffled) {
+        rounds++;
+        reshuffles += reshuffled;
+        if (sessions.length > 0) { sessions.endRound(); }
+    }
+
+    void merge(const SimResult& other) {
+        rounds += other.rounds;
+        reshuffles += other.reshuffles;
+        for (int s = 0; s < MAX_SEATS; s++) {
+            seatWagered[s] += other.seatWagered[s];
+            seatNet[s] += other.seatNet[s];
+        }
+        hands += other.hands;
+        wagered += other.wagered;
+        net += other.net;
+        wins += other.wins;
+        losses += other.losses;
+        pushes += other.pushes;
+        blackjacks += other.blackjacks;
+        surrenders += other.surrenders;
+        roundNet.merge(other.roundNet);
+        sessions.merge(other.sessions);
+        insuranceOffers += other.insuranceOffers;
+        insuranceAdvised += other.insuranceAdvised;
+        insuranceExpected += other.insuranceExpected;
+        insuranceWon += other.insuranceWon;
+        insuranceNet += other.insuranceNet;
+    }
+};
+
+/**********************
+ * Checkpoints. A long run can write out every worker's state now and then, and pick up from the last
+ * checkpoint after being stopped. A worker's state is everything it carries from one round to the next:
+ * the order of its boot and how far it has been dealt, its generator, any state its policy keeps and its
+ * result so far, including the session under way. Workers never share state, so each one can be saved at
+ * whatever round it has reached and the resumed run deals exactly the same cards as one that was never
+ * stopped.
+ *
+ * A background thread asks for a checkpoint every so often. The workers only check one flag per round;
+ * when it is set they copy their state into a buffer and hand it over, and the background thread writes
+ * the file. It is written beside the target, flushed to disk and renamed over the old one, so a crash at
+ * any point leaves either the old checkpoint or the new one.
+ *
+ * The file holds a header, the command line of the run (so a resume needs nothing else), then each
+ * worker's state, and a checksum of everything after the header.
+ **********************/
+
+const uint32_t CHECKPOINT_VERSION = 2;
+
+struct CheckpointHeader {
+    char magic[8] = { 'B', 'J', 'C', 'K', 'P', 'T', '\r', '\n' };
+    uint32_t version = CHECKPOINT_VERSION;
+    uint32_t numWorkers = 0;
+    uint32_t argsSize = 0;          // Bytes of the command line, with each argument ending in a 0
+    uint32_t resultSize = 0;        // sizeof(SimResult) when it was written, since results are saved as they are in memory
+    uint64_t bodySize = 0;          // Bytes after the header
+    uint64_t checksum = 0;          // FNV-1a of the bytes after the header
+    uint8_t padding[24] = {};
+};
+
+static_assert(sizeof(CheckpointHeader) == 64, "The checkpoint header should be 64 bytes");
+static_assert(is_trivially_copyable<SimResult>::value, "Results are saved as they are in memory");
+
+// Appends state to a buffer, as the bytes of each value
+struct CheckpointWriter {
+    vector<char> bytes;
+
+    void write(const void* data, size_t size) {
+        bytes.insert(bytes.end(), (const char*)data, (const char*)data + size);
+        return;
+    }
+
+    template <class T>
+    void write(const T& value) {
+        static_assert(is_trivially_copyable<T>::value, "Only plain values can be written as bytes");
+        write(&value, sizeof(T));
+        return;
+    }
+};
+
+// Reads state back in the order it was written. Every read fails once the bytes run out
+struct CheckpointReader {
+    const char* at = nullptr;
+    const char* end = nullptr;
+
+    bool read(void* data, size_t size) {
+        if ((size_t)(end - at) < size) { return false; }
+        memcpy(data, at, size);
+        at += size;
+        return true;
+    }
+
+    template <class T>
+    bool read(T& value) {
+        static_assert(is_trivially_copyable<T>::value, "Only plain values can be read as bytes");
+        return read(&value, sizeof(T));
+    }
+};
+
+// FNV-1a, to catch a checkpoint that was damaged after it was written
+uint64_t checksum(const char* data, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; i++) { hash = (hash ^ (uint8_t)data[i]) * 0x100000001B3ULL; }
+    return hash;
+}
+
+// Saves a policy's state, for the policies that keep any. Others have nothing to save
+template <class Policy>
+auto savePolicy(const Policy& policy, CheckpointWriter& out, int) -> decltype(policy.save(out), void()) { policy.save(out); }
+template <class Policy>
+void savePolicy(const Policy&, CheckpointWriter&, long) {}
+
+template <class Policy>
+auto restorePolicy(Policy& policy, CheckpointReader& in, int) -> decltype(policy.restore(in)) { return policy.restore(in); }
+template <class Policy>
+bool restorePolicy(Policy&, CheckpointReader&, long) { return true; }
+
+// Collects the workers' states and writes checkpoints in the background. It also holds the states read
+// back from a checkpoint for the workers to resume from
+class Checkpointer {
+    public:
+        ~Checkpointer() { finish(); }
+
+        // Reads a checkpoint, returning false if it is missing, damaged or from another version
+        bool load(const string& filePath) {
+            FILE* in = fopen(filePath.c_str(), "rb");
+            if (!in) { return false; }
+
+            CheckpointHeader header;
+            vector<char> body;
+            bool ok = fread(&header, sizeof(header), 1, in) == 1 && memcmp(header.magic, CheckpointHeader().magic, 8) == 0
+                && header.version == CHECKPOINT_VERSION && header.resultSize == sizeof(SimResult) && header.bodySize < (1ULL << 40);
+            if (ok) {
+                body.resize(header.bodySize);
+                ok = fread(body.data(), 1, body.size(), in) == body.size() && checksum(body.data(), body.size()) == header.checksum;
+            }
+            fclose(in);
+            if (!ok) { return false; }
+
+            CheckpointReader reader = { body.data(), body.data() + body.size() };
+            string argsText(header.argsSize, '\0');
+            if (!reader.read(&argsText[0], argsText.size())) { return false; }
+            for (size_t start = 0, end; (end = argsText.find('\0', start)) != string::npos; start = end + 1) {
+                args.push_back(argsText.substr(start, end - start));
+            }
+
+            saved.assign(header.numWorkers, vector<char>());
+            for (vector<char>& state : saved) {
+                uint64_t size = 0;
+                if (!reader.read(size) || size > (uint64_t)(reader.end - reader.at)) { return false; }
+                state.assign(reader.at, reader.at + size);
+                reader.at += size;
+            }
+            return true;
+        }
+
+        // The command line of the run a loaded checkpoint came from, and how many workers it had
+        const vector<string>& commandLine() const { return args; }
+        int savedWorkers() const { return saved.size(); }
+
+        // The state a worker saved in the loaded checkpoint. Empty when starting afresh
+        CheckpointReader savedState(int worker) const {
+            if (worker >= (int)saved.size()) { return CheckpointReader(); }
+            return CheckpointReader{ saved[worker].data(), saved[worker].data() + saved[worker].size() };
+        }
+
+        // The hands every worker had played in the loaded checkpoint. A worker's state starts with the rounds
+        // it has played, whether it was told to stop and its result so far
+        long long savedHands() const {
+            long long hands = 0;
+            for (int w = 0; w < savedWorkers(); w++) {
+                CheckpointReader in = savedState(w);
+                long long played = 0;
+                bool stopped = false;
+                SimResult result;
+                if (in.read(played) && in.read(stopped) && in.read(result)) { hands += result.hands; }
+            }
+            return hands;
+        }
+
+        // Starts asking the workers for their state every so often, and writing it to the given file
+        void start(const string& filePath, double everySeconds, const vector<string>& commandLineArgs, int numWorkers) {
+            path = filePath;
+            every = everySeconds;
+            args = commandLineArgs;
+            slots = vector<Slot>(numWorkers);
+            for (int w = 0; w < numWorkers && w < (int)saved.size(); w++) { slots[w].state = saved[w]; }
+            writer = thread([this]() { writeLoop(); });
+            return;
+        }
+
+        // Whether a worker should hand over its state. Checked once a round, so it is a single relaxed load
+        bool due(int worker) const { return requested.load(memory_order_relaxed) != slots[worker].epoch; }
+
+        // Whether any worker still playing owes a state. Only called while every worker is held at a StopCheck
+        bool pending() const {
+            return any_of(slots.begin(), slots.end(), [this](const Slot& slot) { return !slot.final && slot.epoch != requested.load(); });
+        }
+
+        // Hands over a worker's state. A final state is kept for every checkpoint after it
+        void deliver(int worker, vector<char>&& state, bool final) {
+            lock_guard<mutex> lock(guard);
+            Slot& slot = slots[worker];
+            slot.state = std::move(state);
+            slot.epoch = requested.load();
+            slot.final = final;
+            delivered.notify_all();
+            return;
+        }
+
+        // Stops the background thread and writes the workers' final states. Returns false if a checkpoint couldn't be written
+        bool finish() {
+            if (!writer.joinable()) { return !failed; }
+            {
+                lock_guard<mutex> lock(guard);
+                stopping = true;
+                delivered.notify_all();
+            }
+            writer.join();
+            writeFile();
+            return !failed;
+        }
+
+    private:
+        // One worker's latest state. Each sits on its own cache line, since the worker reads its epoch every round
+        struct alignas(64) Slot {
+            long long epoch = 0;            // The checkpoint the state was handed over for
+            bool final = false;             // The worker has finished and won't hand over any more
+            vector<char> state;
+        };
+
+        // Asks for a checkpoint, waits for every worker still playing to hand over its state, and writes it out
+        void writeLoop() {
+            unique_lock<mutex> lock(guard);
+            while (!stopping) {
+                delivered.wait_for(lock, chrono::duration<double>(every), [this]() { return stopping; });
+                if (stopping) { break; }
+
+                long long epoch = ++requested;
+                delivered.wait(lock, [this, epoch]() {
+                    return stopping || all_of(slots.begin(), slots.end(), [epoch](const Slot& slot) { return slot.final || slot.epoch == epoch; });
+                });
+                if (stopping) { break; }
+
+                lock.unlock();
+                writeFile();
+                lock.lock();
+            }
+            return;
+        }
+
+        // Writes the latest state of every worker beside the checkpoint, then renames it into place
+        void writeFile() {
+            CheckpointWriter body;
+            for (const string& arg : args) { body.write(arg.c_str(), arg.size() + 1); }
+            size_t argsSize = body.bytes.size();
+            {
+                lock_guard<mutex> lock(guard);
+                for (const Slot& slot : slots) {
+                    body.write((uint64_t)slot.state.size());
+                    body.write(slot.state.data(), slot.state.size());
+                }
+            }
+
+            CheckpointHeader header;
+            header.numWorkers = slots.size();
+            header.argsSize = argsSize;
+            header.resultSize = sizeof(SimResult);
+            header.bodySize = body.bytes.size();
+            header.checksum = checksum(body.bytes.data(), body.bytes.size());
+
+            string temp = path + ".tmp";
+            FILE* out = fopen(temp.c_str(), "wb");
+            bool ok = out && fwrite(&header, sizeof(header), 1, out) == 1 && fwrite(body.bytes.data(), 1, body.bytes.size(), out) == body.bytes.size()
+                && fflush(out) == 0;
+#ifndef _WIN32
+            ok = ok && fsync(fileno(out)) == 0;
+#endif
+            if (out) { ok = fclose(out) == 0 && ok; }
+            ok = ok && rename(temp.c_str(), path.c_str()) == 0;
+            if (!ok) { failed = true; }
+            return;
+        }
+
+        string path;
+        double every = 60;
+        vector<string> args;
+        vector<vector<char>> saved;         // Read from a checkpoint, to resume from
+
+        vector<Slot> slots;
+        atomic<long long> requested{0};     // The latest checkpoint asked for
+        bool stopping = false;
+        atomic<bool> failed{false};
+        mutex guard;
+        condition_variable delivered;
+        thread writer;
+};
+
+// How a simulation is played, besides the rules and the policy
+struct SimOptions {
+    int numSeats = 1;
+    HandLogFile* logFile = nullptr;     // Where to log every round, if anywhere. Single seat runs only
+    int sessionLength = 0;              // Rounds per session, for session results and risk of ruin. 0 for none
+    long long bankroll = 0;             // The chips a player brings to each session
+    double stopAt = 0.0;                // Stop once the 95% confidence interval of the net chips per round is within
+                                        // this many chips either side, instead of playing every hand. 0 plays them all
+    Checkpointer* checkpoint = nullptr; // Where to hand over each worker's state, and the state to resume from, if anywhere
+    int shard = 0, numShards = 1;       // Only the workers whose number is 'shard' modulo 'numShards' are played
+    vector<SimResult>* workerResults = nullptr;    // Where to leave each worker's own result, if anywhere
+};
+
+// Rounds each worker plays between checking in, when a run can stop early
+const long long STOP_CHUNK = 1 << 14;
+
+// Where the workers of a run meet between chunks to decide whether to stop early. The last worker to arrive
+// merges every worker's result in worker order and makes the call for all of them
+class StopCheck {
+    public:
+        StopCheck(int numWorkers, double halfWidth, Checkpointer* checkpointer = nullptr)
+            : target(halfWidth), checkpoint(checkpointer), active(numWorkers), current(numWorkers, nullptr), finished(numWorkers) {}
+
+        // Called by a worker between chunks, with its result so far. Returns true once the run should stop
+        bool stopNow(int worker, const SimResult& result) {
+            unique_lock<mutex> lock(guard);
+            current[worker] = &result;
+
+            if (++arrived == active) {
+                decide();
+            }
+            else {
+                long long round = generation;
+                everyoneIn.wait(lock, [this, round]() { return generation != round; });
+            }
+            return stopping;
+        }
+
+        // Whether every worker should hand over its state after the check it just passed. The workers meet at
+        // the same round numbers after a resume only if they all saved at the same check
+        bool checkpointHere() const { return saving; }
+
+        // Called once by each worker when it is finished, with its final result
+        void leave(int worker, const SimResult& result) {
+            lock_guard<mutex> lock(guard);
+            finished[worker] = result;
+            current[worker] = &finished[worker];
+
+            active--;
+            if (active > 0 && arrived == active) { decide(); }
+            return;
+        }
+
+    private:
+        // Every worker still playing is waiting, so their results can be read
+        void decide() {
+            SimResult merged;
+            for (const SimResult* result : current) {
+                if (result) { merged.merge(*result); }
+            }
+
+            RunningStats perRound = merged.roundNet.stats();
+            stopping = perRound.count > 1 && 1.96 * perRound.error() <= target;
+            saving = checkpoint && checkpoint->pending();
+            arrived = 0;
+            generation++;
+            everyoneIn.notify_all();
+        }
+
+        double target;
+        Checkpointer* checkpoint;
+        int active;
+        int arrived = 0;
+        long long generation = 0;
+        bool stopping = false;
+        bool saving = false;
+        vector<const SimResult*> current;   // Each worker's result when it last checked in
+        vector<SimResult> finished;         // The results of workers that are done
+        mutex guard;
+        condition_variable everyoneIn;
+};
+
+// Plays a number of rounds on one thread with its own game and generator. A single seat plays a Game, and
+// more seats share a Table. With a StopCheck, the worker checks in after every chunk of rounds
+template <class Policy>
+SimResult runWorker(const Rules& rules, uint64_t seed, long long numRounds, Policy policy, const SimOptions& options = SimOptions(),
+                    HandLogWriter* log = nullptr, StopCheck* stop = nullptr, int worker = 0) {
+    SimResult result;
+    result.sessions.length = options.sessionLength;
+    result.sessions.bankroll = options.bankroll;
+    Checkpointer* checkpoint = options.checkpoint;
+    long long played = 0;
+    bool stopped = false;
+
+    // Whether to play on after a number of rounds
+    auto atCheck = [&](long long rounds) { return stop && rounds % STOP_CHUNK == 0 && rounds != numRounds; };
+    auto carryOn = [&](long long rounds) { return !atCheck(rounds) || !stop->stopNow(worker, result); };
+
+    // Whether to hand over a checkpoint. Workers that meet to decide when to stop all save at the same meeting
+    auto saveNow = [&](long long rounds) { return stop ? atCheck(rounds) && stop->checkpointHere() : checkpoint->due(worker); };
+
+    // A worker's state is the rounds it has played, whether it was told to stop, its result, its engine and its policy
+    auto save = [&](const auto& engine, bool final) {
+        CheckpointWriter out;
+        out.write(played);
+        out.write(stopped);
+        out.write(result);
+        engine.save(out);
+        savePolicy(policy, out, 0);
+        checkpoint->deliver(worker, std::move(out.bytes), final);
+    };
+
+    auto resume = [&](auto& engine) {
+        CheckpointReader in = checkpoint->savedState(worker);
+        if (in.at == in.end) { return; }
+        if (!in.read(played) || !in.read(stopped) || !in.read(result) || !engine.restore(in) || !restorePolicy(policy, in, 0)) {
+            cerr << "Worker " << worker << "'s checkpoint doesn't fit this run" << endl;
+            exit(1);
+        }
+    };
+
+    auto play = [&](auto& engine, auto playOne) {
+        if (checkpoint) { resume(engine); }
+
+        while (!stopped && played < numRounds) {
+            playOne();
+            stopped = !carryOn(++played);
+            if (checkpoint && saveNow(played)) { save(engine, false); }
+        }
+        if (checkpoint) { save(engine, true); }
+    };
+
+    if (options.numSeats <= 1) {
+        Game game(rules, seed);
+        play(game, [&]() {
+            const RoundResult& round = log ? playRound(game, policy, *log) : playRound(game, policy);
+            result.add(round);
+            result.endRound(round.reshuffled);
+        });
+    }
+    else {
+        Table table(rules, options.numSeats, seed);
+        play(table, [&]() {
+            playRound(table, policy);
+            for (int s = 0; s < table.seatCount(); s++) {
+                result.add(table.getResult(s), s);
+            }
+            result.endRound(table.getResult(0).reshuffled);
+        });
+    }
+
+    if (stop) { stop->leave(worker, result); }
+    return result;
+}
+
+// Splits a number of rounds across threads and merges the results. The same seed and thread count always
+// give the same totals. A shard of the run only plays its own workers, and merges just their results
+template <class Policy>
+SimResult runParallel(const Rules& rules, uint64_t masterSeed, long long numHands, int numThreads, const Policy& policy,
+                      const SimOptions& options = SimOptions()) {
+    numThreads = max(1, numThreads);
+
+    // Each worker's result sits on its own cache line so the workers never share one
+    struct alignas(64) Slot { SimResult result; };
+    vector<Slot> slots(numThreads);
+    vector<thread> workers;
+
+    StopCheck stopCheck(numThreads, options.stopAt, options.checkpoint);
+    StopCheck* stop = options.stopAt > 0 ? &stopCheck : nullptr;
+
+    for (int w = options.shard; w < numThreads; w += options.numShards) {
+        // Hands are split as evenly as possible, with the first workers taking any remainder
+        long long share = numHands / numThreads + (w < numHands % numThreads ? 1 : 0);
+        uint64_t seed = streamSeed(masterSeed, w);
+
+        workers.emplace_back([&rules, &slots, &policy, &options, w, share, seed, stop]() {
+            if (options.logFile) {
+                HandLogWriter log(*options.logFile, w);
+                slots[w].result = runWorker(rules, seed, share, policy, options, &log, stop, w);
+            }
+            else {
+                slots[w].result = runWorker(rules, seed, share, policy, options, nullptr, stop, w);
+            }
+        });
+    }
+
+    for (thread& worker : workers) { worker.join(); }
+
+    SimResult total;
+    if (options.workerResults) { options.workerResults->assign(numThreads, SimResult()); }
+    for (int w = options.shard; w < numThreads; w += options.numShards) {
+        total.merge(slots[w].result);
+        if (options.workerResults) { (*options.workerResults)[w] = slots[w].result; }
+    }
+
+    return total;
+}
+
+/**********************
+ * The dealer's chances of finishing on each total can be worked out exactly from the cards left in the
+ * shoe, by following every card the dealer could draw until they stand or bust. Which hands the dealer
+ * can draw to doesn't depend on the shoe, so they are listed once per up card, each after every hand that
+ * leads to it, and each shoe is worked out by one pass back through the list. That still takes a moment, so
+ * the answers are kept in a cache keyed by the shoe's composition and the dealer's up card. The cache only
+ * holds so many answers, and the one that went unused the longest is dropped first.
+ **********************/
+
+// The ways the dealer's hand can finish
+enum DealerFinish { DEALER_17 = 0, DEALER_18, DEALER_19, DEALER_20, DEALER_21, DEALER_BUST, DEALER_BLACKJACK, DEALER_FINISHES };
+
+// The chance of each way the dealer's hand can finish
+struct DealerOdds {
+    double finish[DEALER_FINISHES] = {};
+};
+
+class DealerOddsCache {
+    public:
+        DealerOddsCache(size_t maxEntries = 4096) : capacity(max<size_t>(1, maxEntries)) {}
+
+        // The dealer's odds given their up card and the cards they could still draw, including their face down
+        // card. If the dealer has already peeked for blackjack, the face down card can't complete one.
+        DealerOdds odds(const Composition& unseen, int upCard, bool peeked, bool hitSoft17 = false) {
+            Key key = unseen.key(upCard | peeked << 8 | hitSoft17 << 9);
+
+            auto found = index.find(key);
+            if (found != index.end()) {
+                // Move the answer to the front so it is the last to be dropped
+                entries.splice(entries.begin(), entries, found->second);
+                hits++;
+                return found->second->second;
+            }
+
+            misses++;
+            DealerOdds result = calculate(unseen, upCard, peeked, hitSoft17);
+
+            entries.emplace_front(key, result);
+            index[key] = entries.begin();
+
+            if (entries.size() > capacity) {
+                index.erase(entries.back().first);
+                entries.pop_back();
+            }
+
+            return result;
+        }
+
+        // Works out the odds from scratch, without using the cache
+        DealerOdds calculate(const Composition& unseen, int upCard, bool peeked, bool hitSoft17 = false) {
+            const vector<PlanStep>& plan = planFor(upCard, hitSoft17);
+
+            // When the dealer has peeked, the face down card can't be the one that makes blackjack
+            int excluded = 0;
+            if (peeked && upCard == 1) { excluded = 10; }
+            if (peeked && upCard == 10) { excluded = 1; }
+
+            // The cards of each value and up, so the cards that bust a hand can be counted at once
+            int atLeast[12] = {};
+            for (int points = 10; points >= 1; points--) { atLeast[points] = atLeast[points + 1] + unseen.counts[points]; }
+
+            // Every hand draws to hands later in the plan, so working back from the end finds each one's
+            // odds after those of every hand it can reach
+            stepOdds.resize(plan.size());
+            for (int i = (int)plan.size() - 1; i >= 0; i--) {
+                const PlanStep& step = plan[i];
+                int skip = i == 0 ? excluded : 0;
+                double left = unseen.total - step.numDrawn - unseen.counts[skip];
+                DealerOdds result;
+
+                int busting = atLeast[step.bustFrom] - step.drawnBusting - (skip >= step.bustFrom ? unseen.counts[skip] : 0);
+                if (busting > 0) { result.finish[DEALER_BUST] = busting / left; }
+
+                for (int e = 0; e < step.numEdges; e++) {
+                    int points = step.points[e];
+                    int count = unseen.counts[points] - step.drawn[points];
+                    if (count <= 0 || points == skip) { continue; }
+
+                    double chance = count / left;
+                    int next = step.next[e];
+                    if (next < 0) {
+                        result.finish[-1 - next] += chance;
+                        continue;
+                    }
+
+                    // Only the first hand can finish on blackjack, so the hands it leads to never do
+                    const DealerOdds& odds = stepOdds[next];
+                    for (int f = 0; f <= DEALER_BUST; f++) { result.finish[f] += chance * odds.finish[f]; }
+                }
+
+                stepOdds[i] = result;
+            }
+
+            return stepOdds[0];
+        }
+
+        long long cacheHits() const { return hits; }
+        long long cacheMisses() const { return misses; }
+        size_t size() const { return entries.size(); }
+
+    private:
+        typedef Composition::Key Key;
+
+        // A hand the dealer still has to draw to, as the cards drawn after the up card. The cards from 'bustFrom'
+        // up bust it. Each other card either finishes the hand (stored as -1 - the finish) or leads to a later step
+        struct PlanStep {
+            unsigned char drawn[11] = {};       // [points]
+            unsigned char numDrawn = 0;
+            unsigned char bustFrom = 11;        // 11 when no card can bust the hand
+            unsigned char drawnBusting = 0;     // Cards already drawn that would bust the hand
+            unsigned char numEdges = 0;
+            unsigned char points[10] = {};      // The cards that don't bust the hand
+            short next[10] = {};                // Where each of them leads
+        };
+
+        // Whether the dealer is finished drawing on a total
+        static bool stands(const TotalInfo& info, bool hitSoft17) {
+            return info.best > 17 || (info.best == 17 && !(hitSoft17 && info.soft));
+        }
+
+        // Every hand the dealer can draw to from an up card doesn't depend on the shoe, so it is listed once per
+        // up card and rule. Hands are listed by how many cards have been drawn, so a hand only leads to hands
+        // after it. The same cards drawn in a different order are the same step
+        const vector<PlanStep>& planFor(int upCard, bool hitSoft17) {
+            vector<PlanStep>& plan = plans[upCard][hitSoft17];
+            if (!plan.empty()) { return plan; }
+
+            plan.emplace_back();
+            unordered_map<uint64_t, int> found;     // Steps by their drawn cards, four bits per card
+            vector<uint64_t> keys = { 0 };
+
+            for (size_t i = 0; i < plan.size(); i++) {
+                int hard = upCard;
+                bool ace = upCard == 1;
+                for (int points = 1; points <= 10; points++) {
+                    hard += points * plan[i].drawn[points];
+                    ace |= points == 1 && plan[i].drawn[points] > 0;
+                }
+
+                // Counting Aces as 1, any card over 21 - hard busts the hand
+                plan[i].bustFrom = max(1, min(11, 22 - hard));
+                for (int points = plan[i].bustFrom; points <= 10; points++) { plan[i].drawnBusting += plan[i].drawn[points]; }
+
+                for (int points = 1; points < plan[i].bustFrom; points++) {
+                    const TotalInfo& next = TOTALS.entries[ace || points == 1][hard + points];
+                    int edge = plan[i].numEdges++;
+                    plan[i].points[edge] = points;
+
+                    if (stands(next, hitSoft17)) {
+                        plan[i].next[edge] = -1 - (plan[i].numDrawn == 0 && next.best == 21 ? DEALER_BLACKJACK : next.best - 17);
+                        continue;
+                    }
+
+                    uint64_t key = keys[i] + (1ULL << (4 * (points - 1)));
+                    auto known = found.find(key);
+                    if (known != found.end()) {
+                        plan[i].next[edge] = known->second;
+                        continue;
+                    }
+
+                    PlanStep step;
+                    memcpy(step.drawn, plan[i].drawn, sizeof(step.drawn));
+                    step.drawn[points]++;
+                    step.numDrawn = plan[i].numDrawn + 1;
+                    found[key] = plan.size();
+                    plan[i].next[edge] = plan.size();
+                    plan.push_back(step);
+                    keys.push_back(key);
+                }
+            }
+
+            return plan;
+        }
+
+        size_t capacity;
+        list<pair<Key, DealerOdds>> entries;    // Most recently used first
+        unordered_map<Key, list<pair<Key, DealerOdds>>::iterator, Composition::KeyHash> index;
+        long long hits = 0, misses = 0;
+
+        vector<PlanStep> plans[11][2];      // [up card][hits soft 17]
+        vector<DealerOdds> stepOdds;        // The odds from each step of the plan, during a calculation
+};
+
+// Prints the dealer's odds for each up card against a fresh boot, and how long the answers take with and without the cache
+void dealerOdds(int argc, char* argv[]) {
+    Rules rules;
+    rules.numDecks = argValue(argc, argv, "decks", rules.numDecks);
+    rules.hitSoft17 = argValue(argc, argv, "h17", 0) != 0;
+
+    static const char* const upNames[] = { "", "A", "2", "3", "4", "5", "6", "7", "8", "9", "10" };
+    Composition boot = Shoe(rules.numDecks).composition();
+    DealerOddsCache cache;
+
+    cout << "Dealer odds against a fresh " << rules.numDecks << " deck boot, after peeking for blackjack, " << (rules.hitSoft17 ? "hitting" : "standing on")
+         << " soft 17" << endl;
+    cout << "Up      17      18      19      20      21    Bust" << endl;
+
+    cout.setf(ios::fixed);
+    cout.precision(4);
+
+    for (int up = 1; up <= 10; up++) {
+        Composition unseen = boot;
+        unseen.remove(up);
+
+        // The dealer's hands for an up card are listed the first time it is seen, which isn't part of an answer
+        cache.calculate(unseen, up, true, rules.hitSoft17);
+
+        auto start = chrono::steady_clock::now();
+        DealerOdds odds = cache.odds(unseen, up, true, rules.hitSoft17);
+        double cold = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+        start = chrono::steady_clock::now();
+        odds = cache.odds(unseen, up, true, rules.hitSoft17);
+        double warm = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+        cout << (up == 10 ? "" : " ") << upNames[up];
+        for (int f = DEALER_17; f <= DEALER_BUST; f++) { cout << "  " << odds.finish[f]; }
+        cout.precision(1);
+        cout << "   (" << cold << " us to solve, " << warm << " us cached)" << endl;
+        cout.precision(4);
+    }
+
+    return;
+}
+
+/**********************
+ * The book moves are right for a fresh shoe, but the best play changes as cards leave it. The EV calculator
+ * works out the expected value of each action for the exact cards that are left, in units of the hand's
+ * bet. Standing is valued from the dealer's odds, and hitting follows every card the player could draw.
+ *
+ * Every value it works out is remembered, keyed by the composition of the cards left and the hand being
+ * played. After a hit, the new hand and the shoe without the drawn card were already visited when the hit
+ * was valued, so the next decision is mostly answered from memory.
+ *
+ * Split hands are valued as if each one could use half of the hands that are still allowed, and the cards
+ * dealt to one split hand are not removed from the shoe used to value the other. Those are the usual
+ * simplifications. Working it out exactly would mean following every split hand at once.
+ **********************/
+
+// The expected value of each action on the menu, in units of the hand's bet. Help has no value of its own
+struct ActionValues {
+    double ev[6] = {};      // [Action]
+    bool allowed[6] = {};
+
+    // The action with the highest expected value
+    Action best() const {
+        Action result = STAND;
+        for (int a = HIT; a <= SURRENDER; a++) {
+            if (allowed[a] && ev[a] > ev[result]) { result = (Action)a; }
+        }
+        return result;
+    }
+};
+
+class EVCalculator {
+    public:
+        EVCalculator(const Rules& tableRules = Rules(), size_t maxRemembered = 1 << 20)
+            : rules(tableRules), capacity(maxRemembered) {}
+
+        // Values every action for the current hand. 'unseen' is every card the player hasn't seen,
+        // including the dealer's face down card
+        ActionValues evaluate(const Composition& unseen, const Hand& hand, int upCard, bool canDouble, bool canSplit, int handsHeld,
+                              bool canSurrender = false) {
+            start(upCard);
+
+            Composition shoe = unseen;
+            HandValue value = handValue(hand);
+            ActionValues result;
+
+            result.allowed[STAND] = result.allowed[HIT] = true;
+            result.ev[STAND] = standValue(shoe, value.total());
+            result.ev[HIT] = value.total() >= 21 ? -1.0 : hitValue(shoe, value.hard, value.ace);
+
+            if (canDouble) {
+                result.allowed[DOUBLE] = true;
+                result.ev[DOUBLE] = doubleValue(shoe, value.hard, value.ace);
+            }
+
+            if (canSplit && hand.size() == 2) {
+                int pair = CARD_POINTS[hand[0].value];
+                int allowedHands = min(rules.maxHands, MAX_HANDS) - handsHeld + 1;
+
+                // Split the hands that are still allowed evenly between the two new hands. The pair is put back in
+                // the shoe, since splitValue() takes both cards out itself
+                shoe.add(pair);
+                shoe.add(pair);
+                result.allowed[SPLIT] = true;
+                result.ev[SPLIT] = splitValue(shoe, pair, (allowedHands + 1) / 2) + splitValue(shoe, pair, allowedHands / 2);
+            }
+
+            // Surrendering always loses half the bet
+            if (canSurrender) {
+                result.allowed[SURRENDER] = true;
+                result.ev[SURRENDER] = -0.5;
+            }
+
+            return result;
+        }
+
+        // Values every action for the hand the game (or table) is waiting on
+        template <class Engine>
+        ActionValues evaluate(const Engine& game) {
+            return evaluate(game.unseen(), game.hand().cards, CARD_POINTS[game.upCard().value], game.canDouble(), game.canSplit(), game.handCount(),
+                            game.canSurrender());
+        }
+
+        long long remembered() const { return memo.size(); }
+
+    private:
+        // What is being worked out, for the memo keys
+        enum Kind { BEST = 0, SPLIT_HAND = 1 };
+
+        // Sets up for a dealer up card. The dealer peeks when showing an Ace or a ten, so their face down card
+        // can't be the one that would have made blackjack
+        void start(int upCard) {
+            up = upCard;
+            peeked = (up == 1 || up == 10);
+            excluded = !peeked ? 0 : up == 1 ? 10 : 1;
+
+            if (memo.size() > capacity) { memo.clear(); }
+            return;
+        }
+
+        // The chance that the next card the player draws is worth the given points. When the dealer has
+        // peeked, the face down card is known not to be an 'excluded' card, which changes the odds slightly
+        double drawChance(const Composition& shoe, int points) const {
+            double count = shoe.counts[points];
+            if (!excluded) { return count / shoe.total; }
+
+            double others = shoe.total - shoe.counts[excluded];
+            if (points == excluded) { return count / (shoe.total - 1); }
+            return count * (others - 1) / (others * (shoe.total - 1));
+        }
+
+        // The value of standing on a total against the dealer
+        double standValue(const Composition& shoe, int total) {
+            if (total > 21) { return -1.0; }
+
+            DealerOdds odds = dealer.odds(shoe, up, peeked, rules.hitSoft17);
+            double value = odds.finish[DEALER_BUST] - odds.finish[DEALER_BLACKJACK];
+
+            for (int f = DEALER_17; f <= DEALER_21; f++) {
+                int dealerTotal = 17 + f;
+                value += odds.finish[f] * (total > dealerTotal ? 1 : total < dealerTotal ? -1 : 0);
+            }
+
+            return value;
+        }
+
+        // Follows every card the player could draw on a hit, playing on as well as possible afterwards
+        double hitValue(Composition& shoe, int hard, bool ace) {
+            double value = 0.0;
+
+            for (int points = 1; points <= 10; points++) {
+                if (shoe.counts[points] == 0) { continue; }
+                double chance = drawChance(shoe, points);
+
+                const TotalInfo& next = TOTALS.entries[ace || points == 1][hard + points];
+                if (next.bust) {
+                    value -= chance;
+                    continue;
+                }
+
+                shoe.remove(points);
+                // The game stands on 21 automatically
+                value += chance * (next.best == 21 ? standValue(shoe, 21) : bestValue(shoe, hard + points, ace || points == 1));
+                shoe.add(points);
+            }
+
+            return value;
+        }
+
+        // The better of standing and hitting, remembered for each composition and hand
+        double bestValue(Composition& shoe, int hard, bool ace) {
+            Composition::Key key = shoe.key(BEST | up << 2 | hard << 6 | ace << 12);
+
+            auto found = memo.find(key);
+            if (found != memo.end()) { return found->second; }
+
+            // A hand that can't bust by taking a card and is under 17 is never worth standing on: on average the
+            // card doesn't change the dealer's chance of busting, and it can only improve the hand. Skipping the
+            // stand saves working out the dealer's odds for a lot of shoes
+            const TotalInfo& info = TOTALS.entries[ace][hard];
+            bool alwaysHit = (info.soft || hard <= 11) && info.best < 17;
+
+            double value = hitValue(shoe, hard, ace);
+            if (!alwaysHit) { value = max(value, standValue(shoe, info.best)); }
+            memo[key] = value;
+            return value;
+        }
+
+        // Doubles the bet for exactly one more card
+        double doubleValue(Composition& shoe, int hard, bool ace) {
+            double value = 0.0;
+
+            for (int points = 1; points <= 10; points++) {
+                if (shoe.counts[points] == 0) { continue; }
+                double chance = drawChance(shoe, points);
+
+                shoe.remove(points);
+                value += chance * standValue(shoe, TOTALS.entries[ace || points == 1][hard + points].best);
+                shoe.add(points);
+            }
+
+            return 2.0 * value;
+        }
+
+        // The value of a group of split hands that started from one card of the pair and may grow into as
+        // many as 'hands' hands. Both cards of the pair are still in 'shoe' when the split is first valued
+        double splitValue(Composition& shoe, int pair, int hands) {
+            if (hands < 1) { hands = 1; }
+
+            Composition::Key key = shoe.key(SPLIT_HAND | up << 2 | pair << 6 | hands << 12);
+            auto found = memo.find(key);
+            if (found != memo.end()) { return found->second; }
+
+            // Both halves of the pair are out of the shoe while the hands are played
+            shoe.remove(pair);
+            shoe.remove(pair);
+
+            double value = 0.0;
+            for (int points = 1; points <= 10; points++) {
+                if (shoe.counts[points] == 0) { continue; }
+                double chance = drawChance(shoe, points);
+
+                shoe.remove(points);
+                if (points == pair && hands > 1 && pair != 1 && pair != 10) {
+                    // Drawing another card of the pair splits again. Tens are never worth splitting, and split Aces
+                    // are finished after one card. This hand's card and the one drawn are the pair that is split
+                    shoe.add(pair);
+                    shoe.add(pair);
+                    value += chance * (splitValue(shoe, pair, (hands + 1) / 2) + splitValue(shoe, pair, hands / 2));
+                    shoe.remove(pair);
+                    shoe.remove(pair);
+                }
+                else {
+                    value += chance * splitHandValue(shoe, pair + points, pair == 1 || points == 1, pair == 1);
+                }
+                shoe.add(points);
+            }
+
+            shoe.add(pair);
+            shoe.add(pair);
+
+            memo[key] = value;
+            return value;
+        }
+
+        // Plays a split hand once it has its second card
+        double splitHandValue(Composition& shoe, int hard, bool ace, bool splitAces) {
+            int total = TOTALS.entries[ace][hard].best;
+
+            // Split Aces only receive one card, and the game stands on 21 automatically
+            if (splitAces || total == 21) { return standValue(shoe, total); }
+
+            double value = bestValue(shoe, hard, ace);
+            if (rules.doubleAfterSplit) { value = max(value, doubleValue(shoe, hard, ace)); }
+            return value;
+        }
+
+        Rules rules;
+        size_t capacity;                // How many values to remember before starting over
+        DealerOddsCache dealer;
+        unordered_map<Composition::Key, double, Composition::KeyHash> memo;
+
+        int up = 0;                     // The dealer's up card points, Ace = 1
+        bool peeked = false;            // Whether the dealer has checked for blackjack
+        int excluded = 0;               // The card the dealer's face down card can't be after peeking
+};
+
+// Plays whichever action has the highest expected value for the cards left in the shoe
+struct EVPolicy {
+    EVCalculator calculator;
+
+    EVPolicy(const Rules& rules = Rules()) : calculator(rules) {}
+
+    template <class Engine> int bet(const Engine& game) { return game.getRules().minBet; }
+    template <class Engine> int insurance(const Engine&) { return 0; }
+    template <class Engine> Action action(const Engine& game) { return calculator.evaluate(game).best(); }
+};
+
+/**********************
+ * The hand-built charts only cover the rule sets written into makeStrategy(). The solver works out a chart
+ * for any rules instead. Every starting hand is valued against every up card with the EV calculator, for a
+ * full shoe less the player's two cards and the up card, and the action worth the most goes in the cell. A
+ * hard total is valued over every two card hand that makes it, weighted by how likely each one is, and the
+ * move for when doubling isn't allowed is the better of hitting and standing on those same hands. Each up
+ * card is solved on a thread of its own.
+ *
+ * Solving takes seconds, so a solved chart is saved to a small file named after the rules it was solved
+ * for. Later runs map the file into memory and read the chart straight from the mapping.
+ **********************/
+
+// Bumped whenever the solver would give a different chart, so old files are solved again
+const uint32_t STRATEGY_FILE_VERSION = 1;
+
+// The header of a saved chart. The chart itself follows, as the bytes of a StrategyTable
+struct StrategyFileHeader {
+    char magic[8] = { 'B', 'J', 'C', 'H', 'A', 'R', 'T', '\n' };
+    uint32_t version = STRATEGY_FILE_VERSION;
+    uint32_t tableSize = sizeof(StrategyTable);
+    int32_t numDecks = 0, maxHands = 0;
+    uint8_t doubleAfterSplit = 0, hitSoft17 = 0, padding[6] = {};
+    uint64_t checksum = 0;                  // Of the chart's bytes
+};
+
+static_assert(sizeof(StrategyFileHeader) == 40, "The chart file header has a fixed layout");
+static_assert(is_trivially_copyable<StrategyTable>::value, "A chart is saved as raw bytes");
+
+// The rules a chart depends on. The payout and surrender don't change the best play, so they share a chart
+StrategyFileHeader strategyHeader(const Rules& rules) {
+    StrategyFileHeader header;
+    header.numDecks = rules.numDecks;
+    header.maxHands = rules.maxHands;
+    header.doubleAfterSplit = rules.doubleAfterSplit;
+    header.hitSoft17 = rules.hitSoft17;
+    return header;
+}
+
+// Where the chart for a set of rules is kept, e.g. "charts/chart-6d-h17-das-4h.bjc"
+string strategyPath(const Rules& rules, const string& directory) {
+    return directory + "/chart-" + to_string(rules.numDecks) + "d-" + (rules.hitSoft17 ? "h17-" : "s17-")
+        + (rules.doubleAfterSplit ? "das-" : "ndas-") + to_string(rules.maxHands) + "h.bjc";
+}
+
+// The values of each action for a starting hand, added up over the ways it can be dealt
+struct CellValues {
+    double ev[6] = {};
+    double weight = 0.0;
+
+    void add(const ActionValues& values, double chance) {
+        for (int a = HIT; a <= SPLIT; a++) { ev[a] += chance * values.ev[a]; }
+        weight += chance;
+    }
+
+    // The best action among the ones given, or the first of them if the hand can't be dealt at all
+    Action best(initializer_list<Action> actions) const {
+        Action result = *actions.begin();
+        for (Action a : actions) {
+            if (ev[a] > ev[result]) { result = a; }
+        }
+        return result;
+    }
+};
+
+// Values a two card hand against the up card, with both cards and the up card taken out of a full shoe
+ActionValues solveHand(EVCalculator& calculator, Composition shoe, int first, int second, int up, bool canSplit) {
+    Hand hand;
+    hand.push_back(Card(first, 1));
+    hand.push_back(Card(second, 2));
+    shoe.remove(first);
+    shoe.remove(second);
+    return calculator.evaluate(shoe, hand, up, true, canSplit, 1);
+}
+
+// Fills in the chart's column for one up card
+void solveUpCard(EVCalculator& calculator, const Rules& rules, int up, StrategyTable& table) {
+    const unsigned char H = move(HIT, HIT), S = move(STAND, STAND), P = move(SPLIT, SPLIT);
+
+    Composition shoe = Shoe(rules.numDecks).composition();
+    shoe.remove(up);
+
+    // Hard totals, over every pair of cards without an Ace that makes them. Pairs count too, since a pair
+    // that isn't split is played as its total
+    CellValues hard[STRATEGY_ROWS];
+    for (int first = 2; first <= 10; first++) {
+        for (int second = first; second <= 10; second++) {
+            double chance = (double)shoe.counts[first] * (shoe.counts[second] - (first == second)) * (first == second ? 1 : 2);
+            hard[first + second].add(solveHand(calculator, shoe, first, second, up, false), chance);
+        }
+    }
+
+    for (int total = 0; total < STRATEGY_ROWS; total++) {
+        unsigned char cell = total >= 17 ? S : H;
+        if (hard[total].weight > 0) {
+            cell = move(hard[total].best({ STAND, HIT, DOUBLE }), hard[total].best({ STAND, HIT }));
+        }
+        table.cells[HARD][total][up] = cell;
+
+        // Surrender when every way of playing on loses more than half the bet
+        table.surrender[total][up] = hard[total].weight > 0 && hard[total].ev[hard[total].best({ STAND, HIT, DOUBLE })] < -0.5 * hard[total].weight;
+    }
+
+    // Soft totals are an Ace and one other card. Soft 12 is a pair of Aces that can't be split, and soft 21 is blackjack
+    for (int other = 1; other <= 10; other++) {
+        CellValues soft;
+        soft.add(solveHand(calculator, shoe, 1, other, up, false), 1.0);
+        table.cells[SOFT][11 + other][up] = other == 10 ? S : move(soft.best({ STAND, HIT, DOUBLE }), soft.best({ STAND, HIT }));
+    }
+
+    // Pairs are split when that is worth more than the best way of playing the hand whole
+    for (int card = 1; card <= 10; card++) {
+        CellValues pair;
+        pair.add(solveHand(calculator, shoe, card, card, up, true), 1.0);
+        bool split = pair.best({ STAND, HIT, DOUBLE, SPLIT }) == SPLIT;
+        table.cells[PAIR][card][up] = split ? P : (card == 1 ? table.cells[SOFT][12][up] : table.cells[HARD][2 * card][up]);
+    }
+
+    return;
+}
+
+// Works out the chart for a set of rules, one up card at a time on each thread
+StrategyTable solveStrategy(const Rules& rules, int numThreads) {
+    StrategyTable table = {};
+    atomic<int> nextUp(1);
+    vector<thread> workers;
+
+    // Each up card fills its own column, so the threads never write the same cell
+    for (int w = 0; w < max(1, min(numThreads, 10)); w++) {
+        workers.emplace_back([&]() {
+            EVCalculator calculator(rules);
+            for (int up = nextUp++; up <= 10; up = nextUp++) { solveUpCard(calculator, rules, up, table); }
+        });
+    }
+    for (thread& worker : workers) { worker.join(); }
+
+    return table;
+}
+
+// Saves a chart for a set of rules. It is written to a temporary file first and renamed into place, so a
+// reader never sees half a chart
+bool saveStrategy(const string& path, const Rules& rules, const StrategyTable& table) {
+    StrategyFileHeader header = strategyHeader(rules);
+    header.checksum = checksum(reinterpret_cast<const char*>(&table), sizeof(table));
+
+    string temporary = path + ".tmp";
+    FILE* out = fopen(temporary.c_str(), "wb");
+    if (!out) { return false; }
+    bool written = fwrite(&header, sizeof(header), 1, out) == 1 && fwrite(&table, sizeof(table), 1, out) == 1;
+    written = fclose(out) == 0 && written;
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Maps a saved chart into memory and checks it was solved for these rules by this version. The mapping
+// is kept for the rest of the run, since the chart is read straight from it. Returns null if there is no
+// chart to use
+const StrategyTable* loadStrategy(const string& path, const Rules& rules) {
+    const size_t length = sizeof(StrategyFileHeader) + sizeof(StrategyTable);
+
+#ifdef _WIN32
+    // No mmap here, so the chart is read into memory instead
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) { return nullptr; }
+    unique_ptr<char[]> contents(new char[length]);
+    bool complete = fread(contents.get(), 1, length, file) == length;
+    fclose(file);
+    if (!complete) { return nullptr; }
+    const char* data = contents.get();
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { return nullptr; }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size != (off_t)length) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) { return nullptr; }
+    const char* data = static_cast<const char*>(mapped);
+#endif
+
+    StrategyFileHeader expected = strategyHeader(rules);
+    StrategyFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    const StrategyTable* table = reinterpret_cast<const StrategyTable*>(data + sizeof(header));
+
+    expected.checksum = header.checksum;
+    if (memcmp(&header, &expected, sizeof(header)) != 0 || header.checksum != checksum(data + sizeof(header), sizeof(StrategyTable))) {
+#ifndef _WIN32
+        munmap(mapped, length);
+#endif
+        return nullptr;
+    }
+
+#ifdef _WIN32
+    contents.release();
+#endif
+    return table;
+}
+
+// The solved chart for a set of rules. Charts are loaded once per run, from the directory if one was saved
+// there, and otherwise solved and saved for next time. 'solved' says which it was
+const StrategyTable& solvedStrategy(const Rules& rules, const string& directory = ".", int numThreads = 0, bool* solved = nullptr) {
+    static mutex lock;
+    static map<string, const StrategyTable*> loaded;
+    string path = strategyPath(rules, directory);
+
+    lock_guard<mutex> guard(lock);
+    const StrategyTable*& table = loaded[path];
+    if (solved) { *solved = false; }
+    if (!table) { table = loadStrategy(path, rules); }
+
+    if (!table) {
+        if (numThreads <= 0) { numThreads = max(1u, thread::hardware_concurrency()); }
+        StrategyTable fresh = solveStrategy(rules, numThreads);
+        if (solved) { *solved = true; }
+        if (!saveStrategy(path, rules, fresh) || !(table = loadStrategy(path, rules))) {
+            // The chart can't be kept on disk, so it is kept in memory for this run instead
+            table = new StrategyTable(fresh);
+        }
+    }
+
+    return *table;
+}
+
+// Plays the moves of a chart solved for the table's rules, with the minimum bet and no insurance
+struct SolvedPolicy {
+    const StrategyTable* chart;
+
+    SolvedPolicy(const StrategyTable& table) : chart(&table) {}
+
+    template <class Engine> int bet(const Engine& game) { return game.getRules().minBet; }
+    template <class Engine> int insurance(const Engine&) { return 0; }
+
+    template <class Engine>
+    Action action(const Engine& game) {
+        const PlayerHand& hand = game.hand();
+        return bookAction(*chart, hand.value, hand.cards[0], game.upCard(), game.canDouble(), game.canSplit(), game.canSurrender());
+    }
+};
+
+// How a chart cell is printed: the move, then what to do when doubling isn't allowed
+string cellName(unsigned char cell) {
+    static const char* const names[] = { "?", "H", "S", "D", "P", "R" };
+    Action best = (Action)(cell & 15), otherwise = (Action)(cell >> 4);
+    return best == DOUBLE ? (otherwise == STAND ? "Ds" : "Dh") : names[best];
+}
+
+// How a chart row is named: its total, or the paired card
+string rowName(int handClass, int row) { return handClass == PAIR && row == 1 ? "A" : to_string(row); }
+
+// Prints one part of a chart, with a row for each total (or paired card) and a column for each up card
+void showChartRows(const StrategyTable& table, int handClass, int first, int last, const char* label) {
+    char line[160];
+    snprintf(line, sizeof(line), "%-9s   2   3   4   5   6   7   8   9  10   A", label);
+    cout << line << endl;
+
+    for (int row = first; row <= last; row++) {
+        int length = snprintf(line, sizeof(line), "%-9s", rowName(handClass, row).c_str());
+        for (int i = 0; i < 10; i++) {
+            int up = (i == 9 ? 1 : i + 2);
+            string name = cellName(table.cells[handClass][row][up]);
+            if (handClass == HARD && table.surrender[row][up]) { name += "/R"; }
+            length += snprintf(line + length, sizeof(line) - length, "%4s", name.c_str());
+        }
+        cout << line << endl;
+    }
+    return;
+}
+
+// Loads or solves the chart for a set of rules, prints it and compares it with the hand-built chart, e.g.
+// "blackjack strategy --decks 6 --h17 1 --cache charts"
+bool strategyChart(int argc, char* argv[]) {
+    Rules rules = rulesFromArgs(argc, argv);
+    rules.maxHands = max(2, min((int)argValue(argc, argv, "hands", rules.maxHands), MAX_HANDS));
+    string directory = argText(argc, argv, "cache", ".");
+    int numThreads = argValue(argc, argv, "threads", max(1u, thread::hardware_concurrency()));
+
+    // Solve again even if the chart was saved before
+    if (hasFlag(argc, argv, "resolve")) { remove(strategyPath(rules, directory).c_str()); }
+
+    auto start = chrono::steady_clock::now();
+    bool solved = false;
+    const StrategyTable& table = solvedStrategy(rules, directory, numThreads, &solved);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (solved) {
+        int used = max(1, min(numThreads, 10));
+        cout << "Solved the chart for " << ruleName(rules) << " on " << used << (used == 1 ? " thread" : " threads") << " in " << seconds << " seconds" << endl;
+    }
+    else { cout << "Loaded the chart for " << ruleName(rules) << " in " << seconds * 1e6 << " microseconds" << endl; }
+    cout << "Saved as " << strategyPath(rules, directory) << endl << endl;
+
+    cout << "H hit, S stand, Dh/Ds double or else hit/stand, P split, /R surrender when allowed" << endl;
+    showChartRows(table, HARD, 5, 20, "Hard");
+    cout << endl;
+    showChartRows(table, SOFT, 13, 20, "Soft");
+    cout << endl;
+    showChartRows(table, PAIR, 1, 10, "Pair");
+
+    // Where the solver and the hand-built chart disagree
+    const StrategyTable& book = basicStrategy(rules);
+    static const char* const classNames[] = { "Hard", "Soft", "Pair" };
+    static const int firstRow[] = { 5, 13, 1 }, lastRow[] = { 20, 20, 10 };
+    int differences = 0;
+    cout << endl;
+
+    for (int handClass = HARD; handClass <= PAIR; handClass++) {
+        for (int row = firstRow[handClass]; row <= lastRow[handClass]; row++) {
+            for (int up = 1; up <= 10; up++) {
+                bool moveDiffers = table.cells[handClass][row][up] != book.cells[handClass][row][up];
+                bool surrenderDiffers = handClass == HARD && table.surrender[row][up] != book.surrender[row][up];
+                if (!moveDiffers && !surrenderDiffers) { continue; }
+
+                differences++;
+                cout << classNames[handClass] << " " << rowName(handClass, row) << " against " << rowName(PAIR, up)
+                     << ": the book says " << cellName(book.cells[handClass][row][up]) << (surrenderDiffers && book.surrender[row][up] ? "/R" : "")
+                     << ", the solver says " << cellName(table.cells[handClass][row][up]) << (surrenderDiffers && table.surrender[row][up] ? "/R" : "") << endl;
+            }
+        }
+    }
+    cout << differences << (differences == 1 ? " cell differs" : " cells differ") << " from the hand-built chart" << endl;
+
+    return true;
+}
+
+/**********************
+ * The policies above are bound to the engine at compile time, so their answers are inlined into the loop
+ * that plays the rounds. When a policy is only known at run time, from a name on the command line, it is
+ * held in an AnyPolicy instead: a copyable box that forwards each question through one virtual call.
+ * It is only used where policies are picked by name, never in place of a policy the compiler can see.
+ **********************/
+
+class AnyPolicy {
+    public:
+        AnyPolicy() = default;
+
+        template <class Policy, class = enable_if_t<!is_same<decay_t<Policy>, AnyPolicy>::value>>
+        AnyPolicy(Policy policy) : held(new Model<Policy>(std::move(policy))) {
+            static_assert(IsPolicy<Policy, Game>::value && IsPolicy<Policy, Table>::value, "An AnyPolicy must be able to play at a Game and a Table");
+        }
+
+        AnyPolicy(const AnyPolicy& other) : held(other.held ? other.held->clone() : nullptr) {}
+        AnyPolicy(AnyPolicy&&) = default;
+
+        AnyPolicy& operator=(AnyPolicy other) {
+            held.swap(other.held);
+            return *this;
+        }
+
+        explicit operator bool() const { return held != nullptr; }
+
+        int bet(const Game& game) { return held->bet(game); }
+        int insurance(const Game& game) { return held->insurance(game); }
+        Action action(const Game& game) { return held->action(game); }
+
+        int bet(const Table& table) { return held->bet(table); }
+        int insurance(const Table& table) { return held->insurance(table); }
+        Action action(const Table& table) { return held->action(table); }
+
+        // Checkpoints the held policy's state, if it keeps any
+        void save(CheckpointWriter& out) const { held->save(out); }
+        bool restore(CheckpointReader& in) { return held->restore(in); }
+
+    private:
+        struct Concept {
+            virtual ~Concept() = default;
+            virtual Concept* clone() const = 0;
+            virtual int bet(const Game&) = 0;
+            virtual int insurance(const Game&) = 0;
+            virtual Action action(const Game&) = 0;
+            virtual int bet(const Table&) = 0;
+            virtual int insurance(const Table&) = 0;
+            virtual Action action(const Table&) = 0;
+            virtual void save(CheckpointWriter&) const = 0;
+            virtual bool restore(CheckpointReader&) = 0;
+        };
+
+        template <class Policy>
+        struct Model final : Concept {
+            Policy policy;
+
+            explicit Model(Policy held) : policy(std::move(held)) {}
+
+            Concept* clone() const override { return new Model(policy); }
+            int bet(const Game& game) override { return policy.bet(game); }
+            int insurance(const Game& game) override { return policy.insurance(game); }
+            Action action(const Game& game) override { return policy.action(game); }
+            int bet(const Table& table) override { return policy.bet(table); }
+            int insurance(const Table& table) override { return policy.insurance(table); }
+            Action action(const Table& table) override { return policy.action(table); }
+            void save(CheckpointWriter& out) const override { savePolicy(policy, out, 0); }
+            bool restore(CheckpointReader& in) override { return restorePolicy(policy, in, 0); }
+        };
+
+        unique_ptr<Concept> held;
+};
+
+// Builds a policy from its name: dealer, book, solved, ev, random, or a counting system (count or hilo, ko, omega2).
+// Returns an empty policy for a name it doesn't know
+AnyPolicy policyByName(const string& name, const Rules& rules, uint64_t seed = 1, const string& chartDirectory = ".") {
+    if (name == "dealer") { return DealerPolicy(); }
+    if (name == "book") { return BookPolicy(); }
+    if (name == "solved") { return SolvedPolicy(solvedStrategy(rules, chartDirectory)); }
+    if (name == "ev") { return EVPolicy(rules); }
+    if (name == "random") { return RandomPolicy(seed); }
+    if (name == "count" || name == "hilo") { return CountingPolicy<HiLo>(rules); }
+    if (name == "ko") { return CountingPolicy<KnockOut>(rules); }
+    if (name == "omega2") { return CountingPolicy<OmegaII>(rules); }
+    return AnyPolicy();
+}
+
+// Seats a different policy at each seat of a table, chosen by name. A Game only has the first seat
+struct MixedPolicy {
+    vector<AnyPolicy> seats;
+
+    int bet(const Game& game) { return seats[0].bet(game); }
+    int insurance(const Game& game) { return seats[0].insurance(game); }
+    Action action(const Game& game) { return seats[0].action(game); }
+
+    int bet(const Table& table) { return seats[table.currentSeat()].bet(table); }
+    int insurance(const Table& table) { return seats[table.currentSeat()].insurance(table); }
+    Action action(const Table& table) { return seats[table.currentSeat()].action(table); }
+
+    void save(CheckpointWriter& out) const {
+        for (const AnyPolicy& seat : seats) { seat.save(out); }
+    }
+
+    bool restore(CheckpointReader& in) {
+        for (AnyPolicy& seat : seats) {
+            if (!seat.restore(in)) { return false; }
+        }
+        return true;
+    }
+};
+
+// Prints the expected value of every action the player can take
+void showActionValues(GameSink& out, const ActionValues& values) {
+    static const char* const names[] = { "Help", "Hit", "Stand", "Double Down", "Split", "Surrender" };
+
+    ostringstream text;
+    text << "Expected chips won per chip bet:";
+    for (int a = HIT; a <= SURRENDER; a++) {
+        if (values.allowed[a]) {
+            text << "  " << names[a] << " " << (values.ev[a] >= 0 ? "+" : "") << values.ev[a];
+        }
+    }
+    out.line(EVENT_ADVICE, text.str());
+    return;
+}
+
+// Prints the streamed stats of a run: the spread of the net chips per round, how the hands ended, the
+// session results and the risk of ruin
+void showStreamStats(const SimResult& result, const Rules& rules, const SimOptions& options) {
+    RunningStats perRound = result.roundNet.stats();
+    double halfWidth = 1.96 * perRound.error();
+
+    cout << "Net chips per round: mean " << perRound.mean << ", standard deviation " << perRound.stddev() << ", 95% confidence +/-"
+         << halfWidth << " (+/-" << 100.0 * halfWidth / rules.minBet << "% of the minimum bet)" << endl;
+    if (options.stopAt > 0 && halfWidth <= options.stopAt) {
+        cout << "Stopped early, once the confidence interval was narrow enough" << endl;
+    }
+
+    long long outcomes = result.wins + result.blackjacks + result.pushes + result.losses + result.surrenders;
+    if (outcomes > 0) {
+        cout << "Hands won " << 100.0 * result.wins / outcomes << "%, blackjacks " << 100.0 * result.blackjacks / outcomes << "%, pushed "
+             << 100.0 * result.pushes / outcomes << "%, lost " << 100.0 * result.losses / outcomes << "%";
+        if (result.surrenders) { cout << ", surrendered " << 100.0 * result.surrenders / outcomes << "%"; }
+        cout << endl;
+    }
+
+    const SessionStats& sessions = result.sessions;
+    if (sessions.played > 0) {
+        cout << "Sessions of " << options.sessionLength << " rounds: " << sessions.played << " played. Net chips at the 5th, 25th, 50th, 75th and 95th percentiles:";
+        for (double q : { 0.05, 0.25, 0.5, 0.75, 0.95 }) { cout << " " << (long long)round(sessions.results.quantile(q)); }
+        cout << endl;
+
+        // Playing on forever, a player with a positive edge is ruined with a chance of exp(-2 * mean * bankroll / variance)
+        double forever = perRound.mean > 0 ? exp(-2.0 * perRound.mean * options.bankroll / perRound.variance()) : 1.0;
+        cout << "Risk of ruin with " << options.bankroll << " chips: " << 100.0 * sessions.ruined / sessions.played << "% of sessions went broke, "
+             << 100.0 * forever << "% playing on forever" << endl;
+    }
+
+    // What insuring by the exact odds is worth over never insuring, whether or not the policy did
+    if (result.insuranceOffers > 0) {
+        cout << "Insurance: offered " << result.insuranceOffers << " times, worth taking by the exact odds "
+             << 100.0 * result.insuranceAdvised / result.insuranceOffers << "% of them. Taking it then gains " << result.insuranceExpected
+             << " chips on average over never insuring (" << result.insuranceWon << " won), "
+             << (result.wagered ? 100.0 * result.insuranceExpected / result.wagered : 0.0) << "% of the chips wagered. The policy's own insurance won "
+             << result.insuranceNet << endl;
+    }
+    return;
+}
+
+// Reads the rules of a simulation from its command line: the house rules and how the boot is shuffled
+Rules simRules(int argc, char* argv[]) {
+    Rules rules = rulesFromArgs(argc, argv);
+    string shuffle = argText(argc, argv, "shuffle", "lazy");
+    if (shuffle == "full") { rules.shuffle = FULL_SHUFFLE; }
+    if (shuffle == "csm") {
+        rules.shuffle = MACHINE_SHUFFLE;
+        rules.shelves = max(1, (int)argValue(argc, argv, "shelves", rules.shelves));
+    }
+    return rules;
+}
+
+// Reads how a simulation is played from its command line. Rounds are cut into sessions to see how a player with
+// a bankroll fares. The run can also stop as soon as the edge is known to within a share of the minimum bet
+// (--ci 0.1 for +/-0.1%)
+SimOptions simOptions(int argc, char* argv[], const Rules& rules, int numSeats) {
+    SimOptions options;
+    options.numSeats = numSeats;
+    options.sessionLength = max(0LL, argValue(argc, argv, "session", 100));
+    options.bankroll = argValue(argc, argv, "bankroll", 100 * rules.minBet);
+    double ci = atof(argText(argc, argv, "ci", "0").c_str());
+    options.stopAt = ci / 100.0 * rules.minBet;
+    return options;
+}
+
+// Prints the totals of a run, after the line saying how it was played
+void showResult(const SimResult& result, const Rules& rules, const SimOptions& options) {
+    int numSeats = options.numSeats;
+    cout << "Net chips: " << result.net << " over " << result.wagered << " wagered ("
+         << (result.wagered ? 100.0 * result.net / result.wagered : 0.0) << "%)" << endl;
+    cout << "Wins: " << result.wins << ", blackjacks: " << result.blackjacks << ", pushes: " << result.pushes
+         << ", losses: " << result.losses << (rules.surrender ? ", surrenders: " + to_string(result.surrenders) : "") << endl;
+
+    showStreamStats(result, rules, options);
+
+    // With other players at the table the boot runs out in fewer rounds, and each seat sees the count differently
+    if (numSeats > 1) {
+        cout << "Rounds: " << result.rounds << " at " << numSeats << " seats, ";
+        if (rules.shuffle == MACHINE_SHUFFLE) { cout << "shuffled by a machine with " << rules.shelves << " shelves" << endl; }
+        else { cout << (result.reshuffles ? (double)result.rounds / result.reshuffles : 0.0) << " rounds per boot" << endl; }
+        for (int s = 0; s < numSeats; s++) {
+            cout << "Seat " << s + 1 << ": net " << result.seatNet[s] << " over " << result.seatWagered[s] << " wagered ("
+                 << (result.seatWagered[s] ? 100.0 * result.seatNet[s] / result.seatWagered[s] : 0.0) << "%)" << endl;
+        }
+    }
+    return;
+}
+
+/**********************
+ * Sharded runs. A long run can be split across processes, on one machine or on several that share a
+ * directory. Every process is given the same command line and its own shard: "--shard 2/8" plays the
+ * workers whose number is 2 modulo 8. Each worker deals from its own stream of the master seed, so they
+ * are the same workers a single process with that many threads would run, whichever process plays them.
+ *
+ * A shard saves each of its workers' results to a file, and "blackjack merge" adds the files together in
+ * worker order. That is the order a single process merges them in, so the totals, moments and sketches
+ * come out exactly the same. A shard that crashes leaves no file, and only its workers need playing again.
+ **********************/
+
+const uint32_t SHARD_FILE_VERSION = 2;
+
+struct ShardFileHeader {
+    char magic[8] = { 'B', 'J', 'S', 'H', 'A', 'R', 'D', '\n' };
+    uint32_t version = SHARD_FILE_VERSION;
+    uint32_t resultSize = sizeof(SimResult);    // Results are saved as they are in memory
+    uint32_t shard = 0, numShards = 0;
+    uint32_t numWorkers = 0;                    // Workers in the whole run
+    uint32_t heldWorkers = 0;                   // Workers saved in this file
+    uint32_t argsSize = 0;                      // Bytes of the command line, with each argument ending in a 0
+    uint8_t padding[4] = {};
+    uint64_t runId = 0;                         // FNV-1a of the command line, the same for every shard of a run
+    uint64_t bodySize = 0;                      // Bytes after the header
+    uint64_t checksum = 0;                      // FNV-1a of the bytes after the header
+};
+
+static_assert(sizeof(ShardFileHeader) == 64, "The shard file header should be 64 bytes");
+
+// One shard's share of a run, as read back from its file
+struct ShardFile {
+    ShardFileHeader header;
+    vector<string> args;                        // The run's command line, without the shard's own options
+    double seconds = 0.0;                       // How long the shard took to play
+    vector<pair<int, SimResult>> results;       // Each worker's number and result
+};
+
+// Saves a shard's workers' results. The file is written beside the target and renamed into place, so a
+// shard that dies leaves nothing behind rather than half a file
+bool writeShardFile(const string& path, const ShardFile& shard) {
+    CheckpointWriter body;
+    for (const string& arg : shard.args) { body.write(arg.c_str(), arg.size() + 1); }
+    size_t argsSize = body.bytes.size();
+    uint64_t runId = checksum(body.bytes.data(), argsSize);
+
+    body.write(shard.seconds);
+    for (const auto& held : shard.results) {
+        body.write((int32_t)held.first);
+        body.write(held.second);
+    }
+
+    ShardFileHeader header = shard.header;
+    header.heldWorkers = shard.results.size();
+    header.argsSize = argsSize;
+    header.runId = runId;
+    header.bodySize = body.bytes.size();
+    header.checksum = checksum(body.bytes.data(), body.bytes.size());
+
+    string temp = path + ".tmp";
+    FILE* out = fopen(temp.c_str(), "wb");
+    bool ok = out && fwrite(&header, sizeof(header), 1, out) == 1 && fwrite(body.bytes.data(), 1, body.bytes.size(), out) == body.bytes.size();
+    if (out) { ok = fclose(out) == 0 && ok; }
+    ok = ok && rename(temp.c_str(), path.c_str()) == 0;
+    if (!ok) { remove(temp.c_str()); }
+    return ok;
+}
+
+// Reads a shard's results back. Returns false if the file is missing, damaged or from another version
+bool readShardFile(const string& path, ShardFile& shard) {
+    FILE* in = fopen(path.c_str(), "rb");
+    if (!in) { return false; }
+
+    ShardFileHeader& header = shard.header;
+    vector<char> body;
+    bool ok = fread(&header, sizeof(header), 1, in) == 1 && memcmp(header.magic, ShardFileHeader().magic, 8) == 0
+        && header.version == SHARD_FILE_VERSION && header.resultSize == sizeof(SimResult) && header.bodySize < (1ULL << 40);
+    if (ok) {
+        body.resize(header.bodySize);
+        ok = fread(body.data(), 1, body.size(), in) == body.size() && checksum(body.data(), body.size()) == header.checksum;
+    }
+    fclose(in);
+    if (!ok || header.argsSize > body.size() || checksum(body.data(), header.argsSize) != header.runId) { return false; }
+
+    CheckpointReader reader = { body.data() + header.argsSize, body.data() + body.size() };
+    string argsText(body.data(), header.argsSize);
+    shard.args.clear();
+    for (size_t start = 0, end; (end = argsText.find('\0', start)) != string::npos; start = end + 1) {
+        shard.args.push_back(argsText.substr(start, end - start));
+    }
+
+    if (!reader.read(shard.seconds)) { return false; }
+    shard.results.assign(header.heldWorkers, pair<int, SimResult>());
+    for (auto& held : shard.results) {
+        int32_t worker = 0;
+        if (!reader.read(worker) || !reader.read(held.second) || worker < 0 || worker >= (int)header.numWorkers) { return false; }
+        held.first = worker;
+    }
+    return reader.at == reader.end;
+}
+
+// The seats at the table in a simulation: one per policy in a list, or --seats of the same policy
+int simSeats(int argc, char* argv[]) {
+    vector<string> seatPolicies = argList(argc, argv, "policy", "book");
+    if (seatPolicies.size() > 1) { return min((int)seatPolicies.size(), MAX_SEATS); }
+    return max(1, min((int)argValue(argc, argv, "seats", 1), MAX_SEATS));
+}
+
+// Adds up the result files of every shard of a run and reports the run's totals, e.g.
+// "blackjack merge results/shard-*.bjr"
+bool mergeShards(int argc, char* argv[]) {
+    vector<string> paths;
+    for (int i = 2; i < argc; i++) {
+        if (string(argv[i]).compare(0, 2, "--") != 0) { paths.push_back(argv[i]); }
+    }
+    if (paths.empty()) {
+        cout << "Usage: blackjack merge shard-0-of-4.bjr shard-1-of-4.bjr ..." << endl;
+        return false;
+    }
+
+    // Every file must come from the same run, and every worker must be in exactly one of them
+    ShardFile first;
+    vector<SimResult> results;
+    vector<bool> found;
+    double seconds = 0.0;
+
+    for (const string& path : paths) {
+        ShardFile shard;
+        if (!readShardFile(path, shard)) {
+            cout << "Could not read shard results from " << path << endl;
+            return false;
+        }
+
+        if (results.empty()) {
+            first = shard;
+            results.assign(shard.header.numWorkers, SimResult());
+            found.assign(shard.header.numWorkers, false);
+        }
+        else if (shard.header.runId != first.header.runId || shard.header.numWorkers != first.header.numWorkers) {
+            cout << path << " is from a different run than " << paths[0] << endl;
+            return false;
+        }
+
+        for (const auto& held : shard.results) {
+            if (found[held.first]) {
+                cout << "Worker " << held.first << " is in more than one file" << endl;
+                return false;
+            }
+            found[held.first] = true;
+            results[held.first] = held.second;
+        }
+        seconds += shard.seconds;
+    }
+
+    int missing = count(found.begin(), found.end(), false);
+    if (missing > 0) {
+        cout << missing << " of the run's " << found.size() << " workers have no results. Missing workers:";
+        for (int w = 0; w < (int)found.size(); w++) {
+            if (!found[w]) { cout << " " << w; }
+        }
+        cout << endl;
+        return false;
+    }
+
+    SimResult total;
+    for (const SimResult& result : results) { total.merge(result); }
+
+    // The run's own command line says how to report it. The file leaves out the program's path, which the
+    // options are read after
+    vector<string> args = first.args;
+    args.insert(args.begin(), "blackjack");
+    vector<char*> runArgs;
+    for (string& arg : args) { runArgs.push_back(&arg[0]); }
+    int runArgc = runArgs.size();
+    Rules rules = simRules(runArgc, runArgs.data());
+    SimOptions options = simOptions(runArgc, runArgs.data(), rules, simSeats(runArgc, runArgs.data()));
+
+    cout << "Merged " << paths.size() << (paths.size() == 1 ? " shard: " : " shards: ") << total.hands << " hands with the "
+         << argText(runArgc, runArgs.data(), "policy", "book") << " policy over " << results.size() << " workers, in " << seconds
+         << " seconds of shard time" << endl;
+    showResult(total, rules, options);
+    return true;
+}
+
+// Plays a number of hands without any input or output and reports how fast they were played
+void simulate(int argc, char* argv[]) {
+    // A resumed run takes its whole command line from the checkpoint, so it plays exactly the same run
+    Checkpointer checkpoint;
+    string resumePath = argText(argc, argv, "resume", "");
+    vector<string> args(argv, argv + argc);
+    vector<char*> resumedArgs;
+    if (!resumePath.empty()) {
+        if (!checkpoint.load(resumePath)) {
+            cout << "Could not resume from " << resumePath << endl;
+            return;
+        }
+        args = checkpoint.commandLine();
+        for (string& arg : args) { resumedArgs.push_back(&arg[0]); }
+        argc = resumedArgs.size();
+        argv = resumedArgs.data();
+        cout << "Resuming from " << resumePath << endl;
+    }
+
+    long long numHands = argValue(argc, argv, "hands", 1000000);
+    uint64_t seed = argValue(argc, argv, "seed", 1);
+    int numThreads = argValue(argc, argv, "threads", max(1u, thread::hardware_concurrency()));
+    int numSeats = simSeats(argc, argv);
+
+    string policy = argText(argc, argv, "policy", "book");
+    vector<string> seatPolicies = argList(argc, argv, "policy", "book");
+
+    Rules rules = simRules(argc, argv);
+
+    // Solved charts are kept in this directory
+    string chartDirectory = argText(argc, argv, "cache", ".");
+
+    // With --insurance exact, every seat insures whenever the exact odds say it pays instead of by its policy's own rule
+    bool exactInsurance = argText(argc, argv, "insurance", "policy") == "exact";
+
+    // A list of policies seats one of each at the table, in order. They are picked by name, so they play
+    // through AnyPolicy rather than being inlined. So do the seats of a run with exact insurance
+    MixedPolicy mixed;
+    if (seatPolicies.size() > 1 || exactInsurance) {
+        int listed = seatPolicies.size() > 1 ? seatPolicies.size() : numSeats;
+        for (int s = 0; s < listed && s < MAX_SEATS; s++) {
+            string name = seatPolicies.size() > 1 ? seatPolicies[s] : policy;
+            if (seatPolicies.size() == 1 && name == "count") { name = argText(argc, argv, "system", "hilo"); }
+
+            AnyPolicy seat = policyByName(name, rules, streamSeed(seed, MAX_SEATS + s), chartDirectory);
+            if (!seat) {
+                cout << "Unknown policy " << name << ". Available policies: dealer, book, solved, ev, random, count, hilo, ko, omega2" << endl;
+                return;
+            }
+            if (exactInsurance) { seat = ExactInsurance<AnyPolicy>(std::move(seat)); }
+            mixed.seats.push_back(std::move(seat));
+        }
+        if (seatPolicies.size() == 1 && policy == "count") { policy += " (" + argText(argc, argv, "system", "hilo") + ")"; }
+    }
+
+    SimOptions options = simOptions(argc, argv, rules, numSeats);
+
+    // A shard of the run plays only its own workers and saves their results for "blackjack merge". The
+    // file holds the run's command line without the shard's own options, so every shard of a run agrees
+    ShardFile shard;
+    vector<SimResult> workerResults;
+    string shardText = argText(argc, argv, "shard", "");
+    string resultPath;
+    if (!shardText.empty()) {
+        int index = -1, count = 0;
+        if (sscanf(shardText.c_str(), "%d/%d", &index, &count) != 2 || count < 1 || index < 0 || index >= count || count > numThreads) {
+            cout << "A shard is given as index/count, e.g. --shard 0/4, with no more shards than --threads" << endl;
+            return;
+        }
+        if (options.stopAt > 0 || !argText(argc, argv, "checkpoint", "").empty() || !resumePath.empty() || !argText(argc, argv, "log", "").empty()) {
+            cout << "A shard can't stop early, be checkpointed or write a hand history log" << endl;
+            return;
+        }
+
+        options.shard = index;
+        options.numShards = count;
+        options.workerResults = &workerResults;
+        resultPath = argText(argc, argv, "result", "shard-" + to_string(index) + "-of-" + to_string(count) + ".bjr");
+
+        shard.header.shard = index;
+        shard.header.numShards = count;
+        shard.header.numWorkers = numThreads;
+
+        // The program's own path is left out, so shards started from different places still agree
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "--shard" || arg == "--result" || arg == "--threads") { i++; }
+            else if (arg.compare(0, 8, "--shard=") != 0 && arg.compare(0, 9, "--result=") != 0 && arg.compare(0, 10, "--threads=") != 0) {
+                shard.args.push_back(arg);
+            }
+        }
+        shard.args.push_back("--threads");
+        shard.args.push_back(to_string(numThreads));
+    }
+
+    // Every worker's state can be checkpointed now and then. The thread count is saved with the command
+    // line, since a different count would deal different cards
+    string checkpointPath = argText(argc, argv, "checkpoint", "");
+    if (!checkpointPath.empty()) {
+        if (!resumePath.empty() && checkpoint.savedWorkers() != numThreads) {
+            cout << "The checkpoint has " << checkpoint.savedWorkers() << " workers but the run has " << numThreads << endl;
+            return;
+        }
+        if (!argText(argc, argv, "log", "").empty()) {
+            cout << "A run with a hand history log can't be checkpointed" << endl;
+            return;
+        }
+        if (resumePath.empty()) {
+            args.push_back("--threads");
+            args.push_back(to_string(numThreads));
+        }
+        checkpoint.start(checkpointPath, max(0.01, atof(argText(argc, argv, "checkpoint-every", "60").c_str())), args, numThreads);
+        options.checkpoint = &checkpoint;
+    }
+
+    // Every round can be written to a hand history log. Logs hold single seat rounds only
+    HandLogFile logFile;
+    string logPath = argText(argc, argv, "log", "");
+    if (!logPath.empty() && numSeats == 1) {
+        if (!logFile.open(logPath, rules, seed)) {
+            cout << "Could not create " << logPath << endl;
+            return;
+        }
+        options.logFile = &logFile;
+    }
+
+    // A solved chart is loaded, or solved and saved if there isn't one yet, before the clock starts
+    const StrategyTable* solvedChart = policy == "solved" ? &solvedStrategy(rules, chartDirectory, numThreads) : nullptr;
+
+    // A resumed run only times the hands it plays itself
+    long long resumedHands = resumePath.empty() ? 0 : checkpoint.savedHands();
+
+    auto start = chrono::steady_clock::now();
+    SimResult result;
+    if (!mixed.seats.empty()) {
+        result = runParallel(rules, seed, numHands, numThreads, mixed, options);
+    }
+    else if (policy == "dealer") {
+        result = runParallel(rules, seed, numHands, numThreads, DealerPolicy(), options);
+    }
+    else if (policy == "solved") {
+        result = runParallel(rules, seed, numHands, numThreads, SolvedPolicy(*solvedChart), options);
+    }
+    else if (policy == "ev") {
+        result = runParallel(rules, seed, numHands, numThreads, EVPolicy(rules), options);
+    }
+    else if (policy == "random") {
+        result = runParallel(rules, seed, numHands, numThreads, RandomPolicy(streamSeed(seed, MAX_SEATS)), options);
+    }
+    else if (policy == "count") {
+        // Bets are spread by the count instead of always betting the minimum
+        string system = argText(argc, argv, "system", "hilo");
+        if (system == "ko") {
+            result = runParallel(rules, seed, numHands, numThreads, CountingPolicy<KnockOut>(rules), options);
+        }
+        else if (system == "omega2") {
+            result = runParallel(rules, seed, numHands, numThreads, CountingPolicy<OmegaII>(rules), options);
+        }
+        else {
+            system = "hilo";
+            result = runParallel(rules, seed, numHands, numThreads, CountingPolicy<HiLo>(rules), options);
+        }
+        policy += " (" + system + ")";
+    }
+    else {
+        policy = "book";
+        result = runParallel(rules, seed, numHands, numThreads, BookPolicy(), options);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (!checkpoint.finish()) { cout << "Could not write the checkpoint to " << checkpointPath << endl; }
+
+    if (!shardText.empty()) {
+        shard.seconds = seconds;
+        for (int w = options.shard; w < numThreads; w += options.numShards) { shard.results.push_back({ w, workerResults[w] }); }
+
+        int played = shard.results.size();
+        cout << "Shard " << options.shard << "/" << options.numShards << " played " << result.hands << " hands on " << played
+             << (played == 1 ? " thread" : " threads") << " in " << seconds << " seconds (" << (long long)(result.hands / seconds) << " hands/sec)" << endl;
+        if (!writeShardFile(resultPath, shard)) {
+            cout << "Could not write the results to " << resultPath << endl;
+            return;
+        }
+        cout << "Saved the results of workers";
+        for (const auto& held : shard.results) { cout << " " << held.first; }
+        cout << " of " << numThreads << " to " << resultPath << endl;
+        return;
+    }
+
+    long long playedNow = result.hands - resumedHands;
+    cout << "Played " << result.hands << " hands with the " << policy << (exactInsurance ? " policy and exact insurance" : " policy") << " on " << numThreads << (numThreads == 1 ? " thread" : " threads")
+         << " in " << seconds << " seconds (" << (long long)(playedNow / seconds) << " hands/sec)" << endl;
+    if (resumedHands > 0) {
+        cout << resumedHands << " of the hands were played before the checkpoint. The time and rate are for the " << playedNow << " played since resuming" << endl;
+    }
+    showResult(result, rules, options);
+    return;
+}
+
+// Replays every round in a log through the engine and checks the chips come out the same as when it was played
+bool replayLog(int argc, char* argv[]) {
+    string path = argText(argc, argv, "log", "hands.log");
+
+    HandLogReader reader;
+    if (!reader.open(path)) {
+        cout << "Could not read a hand history log from " << path << endl;
+        return false;
+    }
+
+    Game game(reader.rules(), 0);
+    SimResult logged, replayed;
+    long long mismatches = 0;
+
+    auto start = chrono::steady_clock::now();
+    reader.forEachRound([&](const HandRecord& record, const uint8_t* events) {
+        RoundResult original;
+        original.net = record.net;
+        logged.add(original);
+
+        const RoundResult& result = replayRound(game, record, events);
+        replayed.add(result);
+        mismatches += result.net != record.net;
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "Replayed " << replayed.hands << " rounds in " << seconds << " seconds (" << (long long)(replayed.hands / seconds) << " rounds/sec)" << endl;
+    cout << "Logged net chips: " << logged.net << endl;
+    cout << "Replayed net chips: " << replayed.net << " over " << replayed.wagered << " wagered" << endl;
+    cout << "Wins: " << replayed.wins << ", blackjacks: " << replayed.blackjacks << ", pushes: " << replayed.pushes
+         << ", losses: " << replayed.losses << endl;
+    cout << (mismatches == 0 ? "Every round matches the log." : to_string(mismatches) + " rounds do NOT match the log!") << endl;
+    return mismatches == 0;
+}
+
+
+/**********************
+ * A rule sweep plays a grid of rule variants against the same shoes. Every variant with the same number of
+ * decks is dealt the same shuffled boots in the same order, so the luck of the cards is shared and mostly
+ * cancels out when two variants are compared. That is the method of common random numbers: the difference
+ * between two variants is measured far more precisely than either variant is on its own.
+ *
+ * Work is handed out a batch of shoes at a time. Each batch's boots are shuffled once for each number of
+ * decks, and loaded into every variant's game in turn instead of each variant shuffling its own. A variant
+ * plays each boot until its own cut card comes out, so deeper penetration plays more rounds from the same
+ * boot. Every boot is shuffled from its own stream of the seed, so the thread count doesn't change the cards.
+ *
+ * Each variant's result is compared with a reference: the first variant in the grid with the same number
+ * of decks. The shoe is the unit of pairing. The spread of the per-shoe difference gives the error of the
+ * comparison, next to the error it would have if the two variants had been dealt independent shoes.
+ **********************/
+
+// How many shoes are shuffled at once and shared by every variant
+const int SWEEP_BATCH = 64;
+
+// One variant's totals over the shoes it was dealt. Everything is an integer so workers merge exactly
+struct SweepTotals {
+    SimResult result;
+    long long shoes = 0;
+
+    // Sums over shoes of the net chips (n) and rounds (r), alone and paired with the reference's shoe
+    long long nn = 0, nr = 0, rr = 0;
+    long long nRefN = 0, nRefR = 0, rRefN = 0, rRefR = 0;
+
+    void merge(const SweepTotals& other) {
+        result.merge(other.result);
+        shoes += other.shoes;
+        nn += other.nn;
+        nr += other.nr;
+        rr += other.rr;
+        nRefN += other.nRefN;
+        nRefR += other.nRefR;
+        rRefN += other.rRefN;
+        rRefR += other.rRefR;
+    }
+
+    // Net chips per round
+    double edge() const { return result.rounds ? (double)result.net / result.rounds : 0.0; }
+
+    // The sum over shoes of the squared residuals (net - edge * rounds), which sets the error of edge()
+    double residuals() const {
+        double e = edge();
+        return nn - 2 * e * nr + e * e * rr;
+    }
+
+    // The standard error of edge(), from the spread of the net chips per shoe
+    double error() const {
+        if (shoes < 2) { return 0.0; }
+        double roundsPerShoe = (double)result.rounds / shoes;
+        return sqrt(max(0.0, residuals()) / (shoes - 1) / shoes) / roundsPerShoe;
+    }
+
+    // The standard error of edge() - reference.edge(), with both dealt the same shoes
+    double pairedError(const SweepTotals& reference) const {
+        if (shoes < 2) { return 0.0; }
+        double e = edge(), f = reference.edge();
+        double m = (double)result.rounds / shoes, mRef = (double)reference.result.rounds / reference.shoes;
+
+        double cross = nRefN - f * nRefR - e * rRefN + e * f * rRefR;
+        double spread = residuals() / (m * m) - 2 * cross / (m * mRef) + reference.residuals() / (mRef * mRef);
+        return sqrt(max(0.0, spread) / (shoes - 1) / shoes);
+    }
+};
+
+// Plays one shared boot until the cut card comes out. Returns the net chips, and counts the rounds played
+template <class Policy>
+long long playShoe(Game& game, Policy& policy, const Card* order, SimResult& result, long long& rounds) {
+    game.loadShoe(order);
+
+    long long net = 0;
+    bool reshuffled = false;
+    while (!reshuffled) {
+        const RoundResult& round = playRound(game, policy);
+        result.add(round);
+        result.endRound(round.reshuffled);
+        net += round.net;
+        rounds++;
+        reshuffled = round.reshuffled;
+    }
+
+    return net;
+}
+
+// The variant another is compared with: the first one dealt the same number of decks
+int sweepReference(const vector<Rules>& variants, int v) {
+    int r = 0;
+    while (variants[r].numDecks != variants[v].numDecks) { r++; }
+    return r;
+}
+
+// Plays every variant against the same shoes on a number of threads. 'makePolicy' builds a policy for a
+// variant's rules. The reference of each variant is the first with the same number of decks
+template <class MakePolicy>
+vector<SweepTotals> runSweep(const vector<Rules>& variants, uint64_t seed, long long numShoes, int numThreads, MakePolicy makePolicy) {
+    int numVariants = variants.size();
+    vector<int> reference(numVariants);
+    for (int v = 0; v < numVariants; v++) { reference[v] = sweepReference(variants, v); }
+
+    long long numBatches = (numShoes + SWEEP_BATCH - 1) / SWEEP_BATCH;
+    atomic<long long> nextBatch(0);
+
+    numThreads = max(1, numThreads);
+    vector<vector<SweepTotals>> totals(numThreads, vector<SweepTotals>(numVariants));
+    vector<thread> workers;
+
+    for (int w = 0; w < numThreads; w++) {
+        workers.emplace_back([&, w]() {
+            vector<Shoe> boots;
+            long long refNet[SWEEP_BATCH], refRounds[SWEEP_BATCH];
+
+            for (long long batch = nextBatch++; batch < numBatches; batch = nextBatch++) {
+                long long first = batch * SWEEP_BATCH;
+                int count = min<long long>(SWEEP_BATCH, numShoes - first);
+                int shuffledDecks = 0;
+
+                for (int v = 0; v < numVariants; v++) {
+                    const Rules& rules = variants[v];
+
+                    // Shuffle the batch's boots once for every variant with this many decks
+                    if (rules.numDecks != shuffledDecks) {
+                        Shoe fresh(rules.numDecks);
+                        boots.assign(count, fresh);
+                        for (int i = 0; i < count; i++) {
+                            Xoshiro256 gen(streamSeed(seed, first + i));
+                            boots[i].shuffle(gen);
+                        }
+                        shuffledDecks = rules.numDecks;
+                    }
+
+                    // The game's own generator is only used if a boot runs dry in the middle of a round
+                    Game game(rules, streamSeed(seed ^ 0x5EEDULL, batch));
+                    auto policy = makePolicy(rules);
+                    SweepTotals& total = totals[w][v];
+
+                    for (int i = 0; i < count; i++) {
+                        long long rounds = 0;
+                        long long net = playShoe(game, policy, boots[i].data(), total.result, rounds);
+
+                        if (reference[v] == v) {
+                            refNet[i] = net;
+                            refRounds[i] = rounds;
+                        }
+
+                        total.shoes++;
+                        total.nn += net * net;
+                        total.nr += net * rounds;
+                        total.rr += rounds * rounds;
+                        total.nRefN += net * refNet[i];
+                        total.nRefR += net * refRounds[i];
+                        total.rRefN += rounds * refNet[i];
+                        total.rRefR += rounds * refRounds[i];
+                    }
+                }
+            }
+        });
+    }
+
+    vector<SweepTotals> merged(numVariants);
+    for (int w = 0; w < numThreads; w++) {
+        workers[w].join();
+        for (int v = 0; v < numVariants; v++) { merged[v].merge(totals[w][v]); }
+    }
+
+    return merged;
+}
+
+// Plays a grid of rule variants against common shoes and reports each variant's edge and how it compares
+// with its reference, e.g. "blackjack sweep --decks 2,6 --payout 3:2,6:5 --h17 0,1 --shoes 100000"
+bool ruleSweep(int argc, char* argv[]) {
+    long long numShoes = max(2LL, argValue(argc, argv, "shoes", 100000));
+    uint64_t seed = argValue(argc, argv, "seed", 1);
+    int numThreads = argValue(argc, argv, "threads", max(1u, thread::hardware_concurrency()));
+    string policy = argText(argc, argv, "policy", "book");
+
+    // Every combination of the listed values, with the number of decks changing slowest. The bet is 10 chips
+    // so 3:2, 6:5 and surrender all pay whole chips, and no variant loses out to rounding
+    Rules base;
+    base.minBet = 10;
+    base.shuffle = SHARED_SHUFFLE;
+    vector<Rules> variants(1, base);
+    for (int i = 0; i < NUM_RULE_OPTIONS; i++) {
+        vector<string> values = argList(argc, argv, RULE_OPTIONS[i], RULE_DEFAULTS[i]);
+        if (values.empty()) { values.push_back(RULE_DEFAULTS[i]); }
+
+        vector<Rules> grid;
+        for (const Rules& rules : variants) {
+            for (const string& value : values) {
+                grid.push_back(rules);
+                setRule(grid.back(), RULE_OPTIONS[i], value);
+            }
+        }
+        variants = grid;
+    }
+
+    if (variants.size() > 512) {
+        cout << "The grid has " << variants.size() << " variants. Sweep 512 or fewer at a time." << endl;
+        return false;
+    }
+
+    auto start = chrono::steady_clock::now();
+    vector<SweepTotals> totals;
+    if (policy == "dealer") {
+        totals = runSweep(variants, seed, numShoes, numThreads, [](const Rules&) { return DealerPolicy(); });
+    }
+    else if (policy == "count") {
+        policy = "count (hilo)";
+        totals = runSweep(variants, seed, numShoes, numThreads, [](const Rules& rules) { return CountingPolicy<HiLo>(rules); });
+    }
+    else {
+        policy = "book";
+        totals = runSweep(variants, seed, numShoes, numThreads, [](const Rules&) { return BookPolicy(); });
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    long long rounds = 0;
+    for (const SweepTotals& total : totals) { rounds += total.result.rounds; }
+
+    cout << "Swept " << variants.size() << " rule variants over the same " << numShoes << " shoes with the " << policy << " policy in "
+         << seconds << " seconds (" << (long long)(rounds / seconds) << " rounds/sec)" << endl;
+    cout << "Edge is the player's net chips per round, as a percentage of the minimum bet. Each variant is compared" << endl;
+    cout << "with the first variant dealt the same number of decks, with the error of the difference when both are" << endl;
+    cout << "dealt the same shoes and the error it would have if they had been dealt different ones." << endl << endl;
+
+    char line[256];
+    snprintf(line, sizeof(line), "%-24s %12s %9s %8s %11s %9s %14s", "variant", "rounds", "edge %", "+/-", "difference", "+/- same", "+/- different");
+    cout << line << endl;
+
+    double gain = 0.0;
+    int compared = 0;
+    for (int v = 0; v < (int)variants.size(); v++) {
+        const SweepTotals& total = totals[v];
+        double scale = 100.0 / variants[v].minBet;
+        int r = sweepReference(variants, v);
+
+        if (r == v) {
+            snprintf(line, sizeof(line), "%-24s %12lld %9.3f %8.3f %11s", ruleName(variants[v]).c_str(), total.result.rounds,
+                scale * total.edge(), scale * total.error(), "reference");
+            cout << line << endl;
+            continue;
+        }
+
+        double paired = total.pairedError(totals[r]);
+        double unpaired = sqrt(total.error() * total.error() + totals[r].error() * totals[r].error());
+        snprintf(line, sizeof(line), "%-24s %12lld %9.3f %8.3f %11.3f %9.3f %14.3f", ruleName(variants[v]).c_str(), total.result.rounds,
+            scale * total.edge(), scale * total.error(), scale * (total.edge() - totals[r].edge()), scale * paired, scale * unpaired);
+        cout << line << endl;
+
+        if (paired > 0) {
+            gain += (unpaired / paired) * (unpaired / paired);
+            compared++;
+        }
+    }
+
+    if (compared > 0) {
+        cout << endl << "Sharing the shoes measured the differences as precisely as " << gain / compared
+             << " times as many independent shoes would have, on average" << endl;
+    }
+    return true;
+}
+
+/**********************
+ * Batch mode plays many independent single-seat tables in lockstep. Every table plays the dealer policy
+ * (hit below 17), so every table takes the same steps: deal, check for naturals, let the player draw, let
+ * the dealer draw and settle. Cards still come out of each table's own shoe one at a time, but the checks
+ * that follow each step run across the whole batch: hand totals, soft Aces, busts, the dealer standing on
+ * 17 (or hitting a soft 17) and the payout at settlement, at 3:2 or 6:5.
+ *
+ * Table state is kept as structure-of-arrays of 32 bit integers, so a kernel can work on 8 tables at once
+ * with AVX2 or 16 with AVX-512. The kernels are compiled for each instruction set with target attributes,
+ * and the best one the CPU supports is picked when the program runs. The scalar kernels are the reference
+ * and are used on any other CPU or compiler. Every table is seeded the same way a sim worker seeds its game,
+ * so the batch deals exactly the same cards and reaches exactly the same totals as the scalar engine.
+ **********************/
+
+// The instruction sets the batch kernels are written for
+enum SimdLevel { SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512 };
+
+// One table in a batch: its own boot and generator. Dealing works exactly like DealingShoe::draw()
+struct BatchTable {
+    Shoe boot;
+    Xoshiro256 gen;
+    int tableCards = 0;
+
+    BatchTable(const Rules& rules, uint64_t seed) : boot(rules.numDecks), gen(seed) {
+        if (rules.shuffle == FULL_SHUFFLE) { boot.shuffle(gen); }
+    }
+
+    const Card& draw(const Rules& rules) {
+        if (boot.empty()) { restock(rules, tableCards); }
+        const Card& card = rules.shuffle == LAZY_SHUFFLE ? boot.dealRandom(gen) : boot.deal();
+        tableCards++;
+        return card;
+    }
+
+    // Gathers the cards from the table. Returns true if the boot was reshuffled, like DealingShoe::endRound()
+    bool endRound(const Rules& rules) {
+        tableCards = 0;
+        if (boot.dealt() > rules.reshuffleAt) {
+            restock(rules, 0);
+            return true;
+        }
+        return false;
+    }
+
+    void restock(const Rules& rules, int keep) {
+        if (rules.shuffle == LAZY_SHUFFLE) { boot.collect(keep); }
+        else { boot.reshuffle(gen, keep); }
+    }
+};
+
+// The state of every table in a batch, one array per field
+struct BatchLanes {
+    vector<int32_t> hard, ace, numCards;                    // The player's hand
+    vector<int32_t> dealerHard, dealerAce, dealerCards;     // The dealer's hand
+    vector<int32_t> bet;
+    vector<int32_t> active;     // -1 while the hand is still in play, 0 once it is settled or bust
+    vector<int32_t> draw;       // -1 where the next step deals a card
+    vector<int32_t> won;        // Chips paid back at settlement, including the bet
+    vector<int32_t> outcome;
+
+    void resize(int n) {
+        for (vector<int32_t>* field : { &hard, &ace, &numCards, &dealerHard, &dealerAce, &dealerCards, &bet, &active, &draw, &won, &outcome }) {
+            field->assign(n, 0);
+        }
+    }
+};
+
+// The batch kernels. Each works on the tables from 'begin' up to 'end'
+struct BatchKernels {
+    const char* name;
+    // Takes tables where either side has blackjack out of play
+    void (*naturals)(BatchLanes& lanes, int begin, int end);
+    // Marks the tables whose hand is in play and under 17 (or a soft 17, if it hits one) to draw, and returns how
+    // many there are
+    int (*draws)(const int32_t* hard, const int32_t* ace, const int32_t* active, int32_t* draw, int begin, int end, bool hitSoft17);
+    // Takes tables where the player busted out of play, so the dealer only draws against standing hands
+    void (*standing)(BatchLanes& lanes, int begin, int end);
+    // Works out every table's outcome and what it pays, with blackjack paying 3:2 or 6:5
+    void (*settle)(BatchLanes& lanes, int begin, int end, bool sixToFive);
+};
+
+// The best total for a hard total, counting an Ace as 11 when it doesn't bust the hand
+inline int32_t batchTotal(int32_t hard, int32_t ace) { return hard + (ace && hard <= 11 ? 10 : 0); }
+
+void naturalsScalar(BatchLanes& l, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        bool playerBlackjack = l.numCards[i] == 2 && batchTotal(l.hard[i], l.ace[i]) == 21;
+        bool dealerBlackjack = l.dealerCards[i] == 2 && batchTotal(l.dealerHard[i], l.dealerAce[i]) == 21;
+        l.active[i] = playerBlackjack || dealerBlackjack ? 0 : -1;
+    }
+}
+
+int drawsScalar(const int32_t* hard, const int32_t* ace, const int32_t* active, int32_t* draw, int begin, int end, bool hitSoft17) {
+    int count = 0;
+    for (int i = begin; i < end; i++) {
+        // A soft 17 is an Ace and a hard 7
+        bool hits = batchTotal(hard[i], ace[i]) < 17 || (hitSoft17 && ace[i] && hard[i] == 7);
+        draw[i] = active[i] && hits ? -1 : 0;
+        count += draw[i] != 0;
+    }
+    return count;
+}
+
+void standingScalar(BatchLanes& l, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        if (l.hard[i] > 21) { l.active[i] = 0; }
+    }
+}
+
+// The reference settlement, written the same way as RoundEngine::settleNatural() and RoundEngine::settle()
+void settleScalar(BatchLanes& l, int begin, int end, bool sixToFive) {
+    for (int i = begin; i < end; i++) {
+        int total = batchTotal(l.hard[i], l.ace[i]);
+        int dealerTotal = batchTotal(l.dealerHard[i], l.dealerAce[i]);
+        bool playerBlackjack = l.numCards[i] == 2 && total == 21;
+        bool dealerBlackjack = l.dealerCards[i] == 2 && dealerTotal == 21;
+
+        if (dealerBlackjack) {
+            l.outcome[i] = playerBlackjack ? PUSH : LOSS;
+            l.won[i] = playerBlackjack ? l.bet[i] : 0;
+        }
+        else if (playerBlackjack) {
+            l.outcome[i] = BLACKJACK;
+            l.won[i] = payout(l.bet[i], 21, 2, sixToFive);
+        }
+        else if (l.hard[i] > 21) {
+            l.outcome[i] = BUST;
+            l.won[i] = 0;
+        }
+        else if (dealerTotal > 21 || total > dealerTotal) {
+            l.outcome[i] = WIN;
+            l.won[i] = payout(l.bet[i], total, l.numCards[i]);
+        }
+        else if (total == dealerTotal) {
+            l.outcome[i] = PUSH;
+            l.won[i] = l.bet[i];
+        }
+        else {
+            l.outcome[i] = LOSS;
+            l.won[i] = 0;
+        }
+    }
+}
+
+#ifdef BLACKJACK_X86_SIMD
+
+// Eight tables at a time. Comparisons give -1 in every lane where they hold, which doubles as a mask
+__attribute__((target("avx2")))
+inline __m256i totalAvx2(__m256i hard, __m256i ace) {
+    __m256i soft = _mm256_andnot_si256(_mm256_cmpeq_epi32(ace, _mm256_setzero_si256()), _mm256_cmpgt_epi32(_mm256_set1_epi32(12), hard));
+    return _mm256_add_epi32(hard, _mm256_and_si256(soft, _mm256_set1_epi32(10)));
+}
+
+__attribute__((target("avx2")))
+inline __m256i loadAvx2(const int32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+
+__attribute__((target("avx2")))
+inline void storeAvx2(int32_t* p, __m256i v) { _mm256_storeu_si256((__m256i*)p, v); }
+
+__attribute__((target("avx2")))
+void naturalsAvx2(BatchLanes& l, int begin, int end) {
+    const __m256i two = _mm256_set1_epi32(2), twentyOne = _mm256_set1_epi32(21);
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256i playerBlackjack = _mm256_and_si256(_mm256_cmpeq_epi32(loadAvx2(&l.numCards[i]), two),
+            _mm256_cmpeq_epi32(totalAvx2(loadAvx2(&l.hard[i]), loadAvx2(&l.ace[i])), twentyOne));
+        __m256i dealerBlackjack = _mm256_and_si256(_mm256_cmpeq_epi32(loadAvx2(&l.dealerCards[i]), two),
+            _mm256_cmpeq_epi32(totalAvx2(loadAvx2(&l.dealerHard[i]), loadAvx2(&l.dealerAce[i])), twentyOne));
+        storeAvx2(&l.active[i], _mm256_cmpeq_epi32(_mm256_or_si256(playerBlackjack, dealerBlackjack), _mm256_setzero_si256()));
+    }
+    naturalsScalar(l, i, end);
+}
+
+__attribute__((target("avx2")))
+int drawsAvx2(const int32_t* hard, const int32_t* ace, const int32_t* active, int32_t* draw, int begin, int end, bool hitSoft17) {
+    const __m256i seventeen = _mm256_set1_epi32(17), seven = _mm256_set1_epi32(7);
+    int count = 0;
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256i hardTotal = loadAvx2(hard + i), hasAce = loadAvx2(ace + i);
+        __m256i under = _mm256_cmpgt_epi32(seventeen, totalAvx2(hardTotal, hasAce));
+        if (hitSoft17) {
+            __m256i soft17 = _mm256_andnot_si256(_mm256_cmpeq_epi32(hasAce, _mm256_setzero_si256()), _mm256_cmpeq_epi32(hardTotal, seven));
+            under = _mm256_or_si256(under, soft17);
+        }
+        __m256i mask = _mm256_andnot_si256(_mm256_cmpeq_epi32(loadAvx2(active + i), _mm256_setzero_si256()), under);
+        storeAvx2(draw + i, mask);
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(mask)));
+    }
+    return count + drawsScalar(hard, ace, active, draw, i, end, hitSoft17);
+}
+
+__attribute__((target("avx2")))
+void standingAvx2(BatchLanes& l, int begin, int end) {
+    const __m256i twentyOne = _mm256_set1_epi32(21);
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256i bust = _mm256_cmpgt_epi32(loadAvx2(&l.hard[i]), twentyOne);
+        storeAvx2(&l.active[i], _mm256_andnot_si256(bust, loadAvx2(&l.active[i])));
+    }
+    standingScalar(l, i, end);
+}
+
+// A 6:5 blackjack, bet + bet * 6 / 5. There is no integer division, but a float holds every bet * 6 below 2^24
+// exactly and its division is correctly rounded, so truncating the quotient gives the same answer
+__attribute__((target("avx2")))
+inline __m256i sixToFiveAvx2(__m256i bet) {
+    __m256i six = _mm256_mullo_epi32(bet, _mm256_set1_epi32(6));
+    return _mm256_add_epi32(bet, _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(six), _mm256_set1_ps(5.0f))));
+}
+
+// Every outcome is worked out for every lane, and the first rule that applies in settleScalar() wins
+__attribute__((target("avx2")))
+void settleAvx2(BatchLanes& l, int begin, int end, bool sixToFive) {
+    const __m256i two = _mm256_set1_epi32(2), twentyOne = _mm256_set1_epi32(21);
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256i hard = loadAvx2(&l.hard[i]);
+        __m256i total = totalAvx2(hard, loadAvx2(&l.ace[i]));
+        __m256i dealerTotal = totalAvx2(loadAvx2(&l.dealerHard[i]), loadAvx2(&l.dealerAce[i]));
+        __m256i bet = loadAvx2(&l.bet[i]);
+
+        __m256i playerBlackjack = _mm256_and_si256(_mm256_cmpeq_epi32(loadAvx2(&l.numCards[i]), two), _mm256_cmpeq_epi32(total, twentyOne));
+        __m256i dealerBlackjack = _mm256_and_si256(_mm256_cmpeq_epi32(loadAvx2(&l.dealerCards[i]), two), _mm256_cmpeq_epi32(dealerTotal, twentyOne));
+        __m256i bust = _mm256_cmpgt_epi32(hard, twentyOne);
+        __m256i wins = _mm256_or_si256(_mm256_cmpgt_epi32(dealerTotal, twentyOne), _mm256_cmpgt_epi32(total, dealerTotal));
+        __m256i push = _mm256_cmpeq_epi32(total, dealerTotal);
+
+        // payout(): 3:2 or 6:5 on a two card 21, otherwise even money
+        __m256i evenMoney = _mm256_add_epi32(bet, bet);
+        __m256i blackjackPays = sixToFive ? sixToFiveAvx2(bet) : _mm256_add_epi32(evenMoney, _mm256_srai_epi32(bet, 1));
+        __m256i winPays = _mm256_blendv_epi8(evenMoney, blackjackPays, playerBlackjack);
+
+        // Start from a loss and apply the rules from the last to the first, so the first one that holds wins
+        __m256i outcome = _mm256_set1_epi32(LOSS), won = _mm256_setzero_si256();
+        outcome = _mm256_blendv_epi8(outcome, _mm256_set1_epi32(PUSH), push);
+        won = _mm256_blendv_epi8(won, bet, push);
+        outcome = _mm256_blendv_epi8(outcome, _mm256_set1_epi32(WIN), wins);
+        won = _mm256_blendv_epi8(won, winPays, wins);
+        outcome = _mm256_blendv_epi8(outcome, _mm256_set1_epi32(BUST), bust);
+        won = _mm256_andnot_si256(bust, won);
+        outcome = _mm256_blendv_epi8(outcome, _mm256_set1_epi32(BLACKJACK), playerBlackjack);
+        won = _mm256_blendv_epi8(won, blackjackPays, playerBlackjack);
+        outcome = _mm256_blendv_epi8(outcome, _mm256_blendv_epi8(_mm256_set1_epi32(LOSS), _mm256_set1_epi32(PUSH), playerBlackjack), dealerBlackjack);
+        won = _mm256_blendv_epi8(won, _mm256_and_si256(playerBlackjack, bet), dealerBlackjack);
+
+        storeAvx2(&l.outcome[i], outcome);
+        storeAvx2(&l.won[i], won);
+    }
+    settleScalar(l, i, end, sixToFive);
+}
+
+// Sixteen tables at a time. AVX-512 comparisons give a bit mask instead of a vector
+__attribute__((target("avx512f")))
+inline __m512i totalAvx512(__m512i hard, __m512i ace) {
+    __mmask16 soft = _mm512_test_epi32_mask(ace, ace) & _mm512_cmple_epi32_mask(hard, _mm512_set1_epi32(11));
+    return _mm512_mask_add_epi32(hard, soft, hard, _mm512_set1_epi32(10));
+}
+
+__attribute__((target("avx512f")))
+void naturalsAvx512(BatchLanes& l, int begin, int end) {
+    const __m512i two = _mm512_set1_epi32(2), twentyOne = _mm512_set1_epi32(21);
+    int i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __mmask16 playerBlackjack = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(&l.numCards[i]), two)
+            & _mm512_cmpeq_epi32_mask(totalAvx512(_mm512_loadu_si512(&l.hard[i]), _mm512_loadu_si512(&l.ace[i])), twentyOne);
+        __mmask16 dealerBlackjack = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(&l.dealerCards[i]), two)
+            & _mm512_cmpeq_epi32_mask(totalAvx512(_mm512_loadu_si512(&l.dealerHard[i]), _mm512_loadu_si512(&l.dealerAce[i])), twentyOne);
+        _mm512_storeu_si512(&l.active[i], _mm512_maskz_set1_epi32(~(playerBlackjack | dealerBlackjack), -1));
+    }
+    naturalsScalar(l, i, end);
+}
+
+__attribute__((target("avx512f")))
+int drawsAvx512(const int32_t* hard, const int32_t* ace, const int32_t* active, int32_t* draw, int begin, int end, bool hitSoft17) {
+    const __m512i seventeen = _mm512_set1_epi32(17), seven = _mm512_set1_epi32(7);
+    int count = 0;
+    int i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __m512i hardTotal = _mm512_loadu_si512(hard + i), hasAce = _mm512_loadu_si512(ace + i);
+        __mmask16 hits = _mm512_cmplt_epi32_mask(totalAvx512(hardTotal, hasAce), seventeen);
+        if (hitSoft17) { hits |= _mm512_test_epi32_mask(hasAce, hasAce) & _mm512_cmpeq_epi32_mask(hardTotal, seven); }
+        __mmask16 mask = hits & _mm512_test_epi32_mask(_mm512_loadu_si512(active + i), _mm512_loadu_si512(active + i));
+        _mm512_storeu_si512(draw + i, _mm512_maskz_set1_epi32(mask, -1));
+        count += __builtin_popcount(mask);
+    }
+    return count + drawsScalar(hard, ace, active, draw, i, end, hitSoft17);
+}
+
+__attribute__((target("avx512f")))
+void standingAvx512(BatchLanes& l, int begin, int end) {
+    int i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __mmask16 bust = _mm512_cmpgt_epi32_mask(_mm512_loadu_si512(&l.hard[i]), _mm512_set1_epi32(21));
+        _mm512_storeu_si512(&l.active[i], _mm512_mask_mov_epi32(_mm512_loadu_si512(&l.active[i]), bust, _mm512_setzero_si512()));
+    }
+    standingScalar(l, i, end);
+}
+
+// A 6:5 blackjack, divided as a float like sixToFiveAvx2()
+__attribute__((target("avx512f")))
+inline __m512i sixToFiveAvx512(__m512i bet) {
+    __m512 six = _mm512_maskz_cvtepi32_ps(0xFFFF, _mm512_mullo_epi32(bet, _mm512_set1_epi32(6)));
+    return _mm512_add_epi32(bet, _mm512_maskz_cvttps_epi32(0xFFFF, _mm512_div_ps(six, _mm512_set1_ps(5.0f))));
+}
+
+__attribute__((target("avx512f")))
+void settleAvx512(BatchLanes& l, int begin, int end, bool sixToFive) {
+    const __m512i two = _mm512_set1_epi32(2), twentyOne = _mm512_set1_epi32(21);
+    int i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __m512i hard = _mm512_loadu_si512(&l.hard[i]);
+        __m512i total = totalAvx512(hard, _mm512_loadu_si512(&l.ace[i]));
+        __m512i dealerTotal = totalAvx512(_mm512_loadu_si512(&l.dealerHard[i]), _mm512_loadu_si512(&l.dealerAce[i]));
+        __m512i bet = _mm512_loadu_si512(&l.bet[i]);
+
+        __mmask16 playerBlackjack = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(&l.numCards[i]), two) & _mm512_cmpeq_epi32_mask(total, twentyOne);
+        __mmask16 dealerBlackjack = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(&l.dealerCards[i]), two) & _mm512_cmpeq_epi32_mask(dealerTotal, twentyOne);
+        __mmask16 bust = _mm512_cmpgt_epi32_mask(hard, twentyOne);
+        __mmask16 wins = _mm512_cmpgt_epi32_mask(dealerTotal, twentyOne) | _mm512_cmpgt_epi32_mask(total, dealerTotal);
+        __mmask16 push = _mm512_cmpeq_epi32_mask(total, dealerTotal);
+
+        // payout(): 3:2 or 6:5 on a two card 21, otherwise even money
+        __m512i evenMoney = _mm512_add_epi32(bet, bet);
+        __m512i blackjackPays = sixToFive ? sixToFiveAvx512(bet) : _mm512_add_epi32(evenMoney, _mm512_maskz_srai_epi32(0xFFFF, bet, 1));
+
+        // Start from a loss and apply the rules from the last to the first, so the first one that holds wins
+        __m512i outcome = _mm512_set1_epi32(LOSS), won = _mm512_setzero_si512();
+        outcome = _mm512_mask_mov_epi32(outcome, push, _mm512_set1_epi32(PUSH));
+        won = _mm512_mask_mov_epi32(won, push, bet);
+        outcome = _mm512_mask_mov_epi32(outcome, wins, _mm512_set1_epi32(WIN));
+        won = _mm512_mask_mov_epi32(won, wins, _mm512_mask_mov_epi32(evenMoney, playerBlackjack, blackjackPays));
+        outcome = _mm512_mask_mov_epi32(outcome, bust, _mm512_set1_epi32(BUST));
+        won = _mm512_mask_mov_epi32(won, bust, _mm512_setzero_si512());
+        outcome = _mm512_mask_mov_epi32(outcome, playerBlackjack, _mm512_set1_epi32(BLACKJACK));
+        won = _mm512_mask_mov_epi32(won, playerBlackjack, blackjackPays);
+        outcome = _mm512_mask_mov_epi32(outcome, dealerBlackjack & playerBlackjack, _mm512_set1_epi32(PUSH));
+        outcome = _mm512_mask_mov_epi32(outcome, dealerBlackjack & ~playerBlackjack, _mm512_set1_epi32(LOSS));
+        won = _mm512_mask_mov_epi32(won, dealerBlackjack, _mm512_maskz_mov_epi32(playerBlackjack, bet));
+
+        _mm512_storeu_si512(&l.outcome[i], outcome);
+        _mm512_storeu_si512(&l.won[i], won);
+    }
+    settleScalar(l, i, end, sixToFive);
+}
+
+#endif
+
+// Whether this CPU can run the kernels for an instruction set
+bool simdSupported(SimdLevel level) {
+#ifdef BLACKJACK_X86_SIMD
+    __builtin_cpu_init();
+    if (level == SIMD_AVX512) { return __builtin_cpu_supports("avx512f"); }
+    if (level == SIMD_AVX2) { return __builtin_cpu_supports("avx2"); }
+#endif
+    return level == SIMD_SCALAR;
+}
+
+// The widest instruction set this CPU can run
+SimdLevel bestSimdLevel() {
+    if (simdSupported(SIMD_AVX512)) { return SIMD_AVX512; }
+    if (simdSupported(SIMD_AVX2)) { return SIMD_AVX2; }
+    return SIMD_SCALAR;
+}
+
+// The kernels for an instruction set. Anything the CPU can't run falls back to the scalar kernels
+BatchKernels batchKernels(SimdLevel level) {
+#ifdef BLACKJACK_X86_SIMD
+    if (level == SIMD_AVX512 && simdSupported(level)) { return { "avx512", naturalsAvx512, drawsAvx512, standingAvx512, settleAvx512 }; }
+    if (level == SIMD_AVX2 && simdSupported(level)) { return { "avx2", naturalsAvx2, drawsAvx2, standingAvx2, settleAvx2 }; }
+#endif
+    return { "scalar", naturalsScalar, drawsScalar, standingScalar, settleScalar };
+}
+
+// Plays rounds at many single-seat tables in lockstep, every one of them with the dealer policy
+class BatchTables {
+    public:
+        // Table i is seeded with streamSeed(masterSeed, i), the same seed a sim worker would use for it
+        BatchTables(const Rules& tableRules, int numTables, uint64_t masterSeed, SimdLevel level = bestSimdLevel())
+            : rules(tableRules), kernels(batchKernels(level)) {
+            tables.reserve(numTables);
+            for (int i = 0; i < numTables; i++) {
+                tables.emplace_back(rules, streamSeed(masterSeed, i));
+            }
+            lanes.resize(numTables);
+        }
+
+        // Plays one round at every table and adds each table's hand to the result
+        void playRound(SimResult& result) {
+            int n = tables.size();
+
+            // One card to the player, one face down to the dealer, then one more each, at every table
+            for (int i = 0; i < n; i++) {
+                lanes.hard[i] = lanes.ace[i] = lanes.numCards[i] = 0;
+                lanes.dealerHard[i] = lanes.dealerAce[i] = lanes.dealerCards[i] = 0;
+                lanes.bet[i] = rules.minBet;
+
+                givePlayer(i);
+                giveDealer(i);
+                givePlayer(i);
+                giveDealer(i);
+            }
+
+            kernels.naturals(lanes, 0, n);
+
+            // The player hits until reaching 17, then the dealer draws by the table's rules against every hand that didn't bust
+            while (kernels.draws(lanes.hard.data(), lanes.ace.data(), lanes.active.data(), lanes.draw.data(), 0, n, false) > 0) {
+                for (int i = 0; i < n; i++) {
+                    if (lanes.draw[i]) { givePlayer(i); }
+                }
+            }
+
+            kernels.standing(lanes, 0, n);
+
+            while (kernels.draws(lanes.dealerHard.data(), lanes.dealerAce.data(), lanes.active.data(), lanes.draw.data(), 0, n, rules.hitSoft17) > 0) {
+                for (int i = 0; i < n; i++) {
+                    if (lanes.draw[i]) { giveDealer(i); }
+                }
+            }
+
+            kernels.settle(lanes, 0, n, rules.sixToFive);
+
+            for (int i = 0; i < n; i++) {
+                RoundResult round;
+                round.bet = round.wagered = lanes.bet[i];
+                round.returned = lanes.won[i];
+                round.net = round.returned - round.wagered;
+                round.numHands = 1;
+                round.outcomes[0] = (Outcome)lanes.outcome[i];
+                round.reshuffled = tables[i].endRound(rules);
+
+                result.add(round);
+                result.endRound(round.reshuffled);
+            }
+            return;
+        }
+
+        const char* kernelName() const { return kernels.name; }
+        int size() const { return tables.size(); }
+
+    private:
+        void givePlayer(int i) {
+            const Card& card = tables[i].draw(rules);
+            lanes.hard[i] += CARD_POINTS[card.value];
+            lanes.ace[i] |= (card.value == 1);
+            lanes.numCards[i]++;
+        }
+
+        void giveDealer(int i) {
+            const Card& card = tables[i].draw(rules);
+            lanes.dealerHard[i] += CARD_POINTS[card.value];
+            lanes.dealerAce[i] |= (card.value == 1);
+            lanes.dealerCards[i]++;
+        }
+
+        Rules rules;
+        BatchKernels kernels;
+        vector<BatchTable> tables;
+        BatchLanes lanes;
+};
+
+// Plays rounds at many tables in lockstep and reports hands/sec. With --verify, every table is also played on
+// its own by the scalar engine, and the totals must match exactly
+bool batchSimulate(int argc, char* argv[]) {
+    int numTables = max(1LL, argValue(argc, argv, "tables", 1024));
+    long long numRounds = argValue(argc, argv, "rounds", 1000);
+    uint64_t seed = argValue(argc, argv, "seed", 1);
+
+    string isa = argText(argc, argv, "isa", "auto");
+    SimdLevel level = isa == "scalar" ? SIMD_SCALAR : isa == "avx2" ? SIMD_AVX2 : isa == "avx512" ? SIMD_AVX512 : bestSimdLevel();
+
+    // Each table deals from a lean shoe of its own, which cuts and reshuffles the boot but has no shuffling machine
+    Rules rules = simRules(argc, argv);
+    if (rules.shuffle == MACHINE_SHUFFLE) {
+        cout << "Batch mode can't deal from a shuffling machine. Use sim --shuffle csm instead" << endl;
+        return false;
+    }
+
+    BatchTables batch(rules, numTables, seed, level);
+    SimResult result;
+
+    auto start = chrono::steady_clock::now();
+    for (long long r = 0; r < numRounds; r++) {
+        batch.playRound(result);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "Played " << result.hands << " hands of " << ruleName(rules) << " at " << numTables << " tables with the " << batch.kernelName() << " kernels in "
+         << seconds << " seconds (" << (long long)(result.hands / seconds) << " hands/sec)" << endl;
+    cout << "Net chips: " << result.net << " over " << result.wagered << " wagered" << endl;
+    cout << "Wins: " << result.wins << ", blackjacks: " << result.blackjacks << ", pushes: " << result.pushes
+         << ", losses: " << result.losses << endl;
+
+    if (!hasFlag(argc, argv, "verify")) { return true; }
+
+    SimResult expected;
+    for (int i = 0; i < numTables; i++) {
+        expected.merge(runWorker(rules, streamSeed(seed, i), numRounds, DealerPolicy()));
+    }
+
+    bool same = expected.hands == result.hands && expected.wagered == result.wagered && expected.net == result.net
+        && expected.wins == result.wins && expected.losses == result.losses && expected.pushes == result.pushes
+        && expected.blackjacks == result.blackjacks && expected.reshuffles == result.reshuffles;
+
+    cout << (same ? "Matches the scalar engine exactly." : "Does NOT match the scalar engine!") << endl;
+    return same;
+}
+
+/**********************
+ * Table server. Many players can play at once over TCP or a Unix socket, each at a single-seat table of
+ * their own, sending one command per line and getting one event per line back. A few worker threads each
+ * run an epoll loop over the connections they accepted, so no thread ever waits on a player. Rounds are
+ * played by the same Game engine as everything else; the server only narrates what the engine did.
+ *
+ * The console game pauses between cards with sleep_for. Here every line is scheduled for when it should be
+ * shown instead, and the loop sends it once it is due, so a paused table costs nothing while it waits.
+ *
+ *      From the player: BET n, INSURE n, HIT, STAND, DOUBLE, SPLIT, SURRENDER, HELP, STATS, QUIT
+ *      HELLO chips=1000 min=5 max=300         on connecting
+ *      CARD you|dealer <card> [hand=n]         a card is dealt, e.g. AS or 10H. The face down card is ??
+ *      SPLIT hand=n                            a pair is split into a new hand
+ *      REVEAL <card>                           the dealer turns over the face down card
+ *      INSURANCE max=n                         the dealer shows an Ace. Answer with INSURE
+ *      TURN hand=n total=15 soft=0 up=10 options=HIT,STAND,DOUBLE
+ *      RESULT net=-5 chips=995                 the round is over. Answer with BET
+ *      SHUFFLE                                 the boot was reshuffled after the round
+ *      BOOK <move>                             the answer to HELP, or BOOK INSURE n while insurance is offered
+ *      STATS sessions=n rounds=n cpu=seconds   the answer to STATS, for the load generator
+ *      ERROR <reason>
+ **********************/
+
+// A card as a short code: the rank, then the first letter of the suit
+string cardCode(const Card& card) {
+    static const char* const ranks[] = { "A", "2", "3", "4", "5", "6", "7", "8", "9", "10", "J", "Q", "K" };
+    static const char suits[] = { 'C', 'S', 'D', 'H' };
+    return string(ranks[card.value - 1]) + suits[card.suit - 1];
+}
+
+const char* const ACTION_WORDS[] = { "HELP", "HIT", "STAND", "DOUBLE", "SPLIT", "SURRENDER" };
+
+#ifdef __linux__
+
+struct ServerOptions {
+    int port = 7777;
+    string unixPath;            // Listen on a Unix socket at this path instead of TCP
+    int threads = 1;
+    int paceMs = 1000;          // The pause between cards, like the console game. 0 sends everything at once
+    int chips = 1000;           // Each player's starting chips
+    uint64_t seed = 1;
+    int seconds = 0;            // Stop after this long. 0 runs until interrupted
+};
+
+// Counted across every worker. Read by STATS and when the server stops
+atomic<long long> serverSessions(0), serverOpen(0), serverRounds(0);
+volatile sig_atomic_t serverStopping = 0;
+
+void stopServer(int) { serverStopping = 1; }
+
+// The CPU time the whole process has used, in seconds
+double processCpuSeconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+// Lets a process hold as many connections as the system allows, since the default limit is only 1024
+void raiseFileLimit() {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    return;
+}
+
+// Opens the listening socket, on localhost or at a Unix socket path. Returns -1 on failure
+int listenSocket(const ServerOptions& options) {
+    int fd;
+    if (!options.unixPath.empty()) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (options.unixPath.size() >= sizeof(address.sun_path)) { return -1; }
+        strcpy(address.sun_path, options.unixPath.c_str());
+        unlink(address.sun_path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0) { return -1; }
+    }
+    else {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(options.port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int on = 1;
+        if (fd < 0) { return -1; }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, (sockaddr*)&address, sizeof(address)) != 0) { return -1; }
+    }
+
+    if (listen(fd, SOMAXCONN) != 0) { return -1; }
+    return fd;
+}
+
+// Connects to a server on localhost or at a Unix socket path, blocking until it is connected. Returns -1 on failure
+int connectSocket(int port, const string& unixPath) {
+    int fd;
+    if (!unixPath.empty()) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, unixPath.c_str(), sizeof(address.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) { return -1; }
+    }
+    else {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) { return -1; }
+
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+// One player's connection and the table they are playing at
+struct ServerSession {
+    using Clock = chrono::steady_clock;
+
+    ServerSession(int socket, const Rules& rules, uint64_t seed, int startingChips) : fd(socket), game(rules, seed), chips(startingChips) {}
+
+    int fd;
+    Game game;
+    int chips;
+
+    string input;               // Bytes read that don't make a whole line yet
+    string output;              // Lines that are due but the socket hasn't taken yet
+    bool writing = false;       // Whether epoll is watching for the socket to take more
+    bool dead = false;          // Hung up or quit. Closed by the loop once it is done with the session
+
+    // Lines waiting for their time to be shown, in order. 'armed' is when the worker's timer is set to come back
+    vector<pair<Clock::time_point, string>> paced;
+    size_t pacedNext = 0;
+    Clock::time_point lastDue;
+    Clock::time_point armed = Clock::time_point::max();
+
+    // How much of the table has been narrated
+    int shownCards[MAX_HANDS] = {};
+    int shownDealer = 0;
+};
+
+// Runs one epoll loop over the connections it accepts, and the timers that pace their tables
+class ServerWorker {
+    public:
+        using Clock = chrono::steady_clock;
+
+        ServerWorker(int listener, const Rules& tableRules, const ServerOptions& serverOptions)
+            : listenFd(listener), rules(tableRules), options(serverOptions), pace(chrono::milliseconds(serverOptions.paceMs)) {}
+
+        void run() {
+            epollFd = epoll_create1(0);
+            epoll_event event = {};
+            event.events = EPOLLIN | EPOLLEXCLUSIVE;
+            event.data.fd = listenFd;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+
+            epoll_event events[256];
+            while (!serverStopping) {
+                // Sleep until the next paced line is due, but wake now and then to see if the server is stopping
+                int timeout = 100;
+                if (!timers.empty()) {
+                    auto wait = chrono::duration_cast<chrono::milliseconds>(timers.top().first - Clock::now()).count() + 1;
+                    timeout = (int)max<long long>(0, min<long long>(wait, timeout));
+                }
+
+                int ready = epoll_wait(epollFd, events, 256, timeout);
+                for (int i = 0; i < ready; i++) {
+                    if (events[i].data.fd == listenFd) {
+                        acceptAll();
+                        continue;
+                    }
+
+                    auto found = sessions.find(events[i].data.fd);
+                    if (found == sessions.end()) { continue; }
+                    ServerSession& session = *found->second;
+
+                    if (events[i].events & (EPOLLERR | EPOLLHUP)) { session.dead = true; }
+                    if (!session.dead && (events[i].events & EPOLLOUT)) { send(session); }
+                    if (!session.dead && (events[i].events & EPOLLIN)) { receive(session); }
+                    if (session.dead) { closeSession(session); }
+                }
+
+                fireTimers();
+            }
+
+            while (!sessions.empty()) { closeSession(*sessions.begin()->second); }
+            close(epollFd);
+            return;
+        }
+
+    private:
+        void acceptAll() {
+            while (true) {
+                int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK);
+                if (fd < 0) { return; }
+
+                if (options.unixPath.empty()) {
+                    int on = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                }
+
+                long long number = serverSessions++;
+                serverOpen++;
+                ServerSession& session = *(sessions[fd] = unique_ptr<ServerSession>(new ServerSession(fd, rules, streamSeed(options.seed, number), options.chips)));
+
+                epoll_event event = {};
+                event.events = EPOLLIN;
+                event.data.fd = fd;
+                epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+
+                say(session, "HELLO chips=" + to_string(session.chips) + " min=" + to_string(rules.minBet) + " max=" + to_string(rules.maxBet), false);
+            }
+        }
+
+        // Reads what the player sent and plays every whole line as it arrives, so only an unfinished line is held
+        void receive(ServerSession& session) {
+            char buffer[4096];
+            while (!session.dead) {
+                ssize_t got = recv(session.fd, buffer, sizeof(buffer), 0);
+                if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    session.dead = true;
+                    return;
+                }
+                if (got < 0) { break; }
+                session.input.append(buffer, got);
+
+                size_t start = 0, end;
+                while (!session.dead && (end = session.input.find('\n', start)) != string::npos) {
+                    string line = session.input.substr(start, end - start);
+                    if (!line.empty() && line.back() == '\r') { line.pop_back(); }
+                    start = end + 1;
+
+                    if (!command(session, line)) { session.dead = true; }
+                }
+                session.input.erase(0, start);
+
+                // Nobody sends a command this long, so a player who keeps sending without a newline is cut off
+                // before the line can grow any further
+                if (session.input.size() > 1024) { session.dead = true; }
+            }
+            return;
+        }
+
+        // Plays one command. Returns false when the player is leaving
+        bool command(ServerSession& session, const string& line) {
+            Game& game = session.game;
+            size_t space = line.find(' ');
+            string word = line.substr(0, space);
+            int amount = space == string::npos ? 0 : atoi(line.c_str() + space + 1);
+
+            // What the player can still put on the table this round
+            int available = session.chips - (game.getPhase() == Game::BETTING ? 0 : game.getResult().wagered);
+
+            if (word == "QUIT") { return false; }
+            if (word == "STATS") {
+                say(session, "STATS sessions=" + to_string(serverOpen.load()) + " rounds=" + to_string(serverRounds.load())
+                    + " cpu=" + to_string(processCpuSeconds()), false);
+                return true;
+            }
+
+            if (word == "BET") {
+                if (game.getPhase() != Game::BETTING) { return error(session, "not betting now"); }
+                if (amount < rules.minBet || amount > rules.maxBet) { return error(session, "bets are " + to_string(rules.minBet) + "-" + to_string(rules.maxBet)); }
+                if (amount > session.chips) { return error(session, "not enough chips"); }
+
+                // The opening cards go out one at a time: the player, the dealer face down, the player and the dealer face up
+                game.deal(amount);
+                say(session, "CARD you " + cardCode(game.hand(0).cards[0]), true);
+                say(session, "CARD dealer ??", true);
+                say(session, "CARD you " + cardCode(game.hand(0).cards[1]), true);
+                say(session, "CARD dealer " + cardCode(game.upCard()), true);
+                session.shownCards[0] = 2;
+                session.shownDealer = 2;
+            }
+            else if (word == "INSURE") {
+                if (game.getPhase() != Game::INSURANCE) { return error(session, "no insurance now"); }
+                game.insure(max(0, min(amount, available)));
+            }
+            else if (word == "HELP") {
+                // While insurance is offered, the answer is how much to place by the exact odds
+                if (game.getPhase() == Game::INSURANCE) {
+                    say(session, "BOOK INSURE " + to_string(min(insuranceAdvice(game), available)), false);
+                    return true;
+                }
+                if (game.getPhase() != Game::PLAYER_TURN) { return error(session, "not your turn"); }
+                const PlayerHand& hand = game.hand();
+                Action book = bookAction(basicStrategy(rules), hand.value, hand.cards[0], game.upCard(), game.canDouble(), game.canSplit(),
+                                         game.canSurrender());
+                say(session, string("BOOK ") + ACTION_WORDS[book], false);
+                return true;
+            }
+            else {
+                int action = find(ACTION_WORDS + HIT, ACTION_WORDS + SURRENDER + 1, word) - ACTION_WORDS;
+                if (action > SURRENDER) { return error(session, "unknown command " + word); }
+                if (game.getPhase() != Game::PLAYER_TURN) { return error(session, "not your turn"); }
+                if ((action == DOUBLE || action == SPLIT) && available < game.hand().bet) { return error(session, "not enough chips"); }
+
+                int playing = game.currentHand(), handsBefore = game.handCount();
+                if (!game.act((Action)action)) { return error(session, string("can't ") + ACTION_WORDS[action] + " now"); }
+
+                // The second card of the pair moves to the new hand, then each hand is dealt its next card
+                if (game.handCount() > handsBefore) {
+                    say(session, "SPLIT hand=" + to_string(playing), true);
+                    session.shownCards[playing] = 1;
+                    session.shownCards[handsBefore] = 1;
+                }
+            }
+
+            narrate(session);
+            prompt(session);
+            return true;
+        }
+
+        bool error(ServerSession& session, const string& reason) {
+            say(session, "ERROR " + reason, false);
+            return true;
+        }
+
+        // Tells the player about every card dealt since the last narration
+        void narrate(ServerSession& session) {
+            Game& game = session.game;
+            for (int i = 0; i < game.handCount(); i++) {
+                const Hand& cards = game.hand(i).cards;
+                for (; session.shownCards[i] < cards.size(); session.shownCards[i]++) {
+                    string line = "CARD you " + cardCode(cards[session.shownCards[i]]);
+                    if (game.handCount() > 1) { line += " hand=" + to_string(i); }
+                    say(session, line, true);
+                }
+            }
+
+            if (game.getPhase() != Game::ROUND_OVER) { return; }
+
+            const Hand& dealer = game.dealerHand();
+            say(session, "REVEAL " + cardCode(dealer[0]), true);
+            for (; session.shownDealer < dealer.size(); session.shownDealer++) {
+                say(session, "CARD dealer " + cardCode(dealer[session.shownDealer]), true);
+            }
+            return;
+        }
+
+        // Asks the player for their next move, or settles up once the round is over
+        void prompt(ServerSession& session) {
+            Game& game = session.game;
+
+            if (game.getPhase() == Game::INSURANCE) {
+                int available = session.chips - game.getResult().wagered;
+                say(session, "INSURANCE max=" + to_string(max(0, min(game.getResult().bet / 2, available))), false);
+            }
+            else if (game.getPhase() == Game::PLAYER_TURN) {
+                const PlayerHand& hand = game.hand();
+                string options = "HIT,STAND";
+                if (game.canDouble()) { options += ",DOUBLE"; }
+                if (game.canSplit()) { options += ",SPLIT"; }
+                if (game.canSurrender()) { options += ",SURRENDER"; }
+
+                say(session, "TURN hand=" + to_string(game.currentHand()) + " total=" + to_string(hand.value.total()) + " soft="
+                    + to_string(hand.value.soft() ? 1 : 0) + " up=" + to_string(CARD_POINTS[game.upCard().value]) + " options=" + options, false);
+            }
+            else if (game.getPhase() == Game::ROUND_OVER) {
+                game.endRound();
+                const RoundResult& result = game.getResult();
+                session.chips += result.net;
+                fill(begin(session.shownCards), end(session.shownCards), 0);
+                serverRounds++;
+
+                say(session, "RESULT net=" + to_string(result.net) + " chips=" + to_string(session.chips), false);
+                if (result.reshuffled) { say(session, "SHUFFLE", false); }
+            }
+            return;
+        }
+
+        // Queues a line for the player. A paced line is shown one pause after the line before it; any other
+        // line follows straight after whatever is already waiting
+        void say(ServerSession& session, const string& line, bool paced) {
+            Clock::time_point now = Clock::now();
+            bool waiting = session.pacedNext < session.paced.size();
+
+            if (!waiting && (!paced || options.paceMs == 0)) {
+                session.output += line;
+                session.output += '\n';
+                send(session);
+                return;
+            }
+
+            Clock::time_point due = max(now, session.lastDue) + (paced ? pace : Clock::duration::zero());
+            session.paced.emplace_back(due, line);
+            session.lastDue = due;
+            if (!waiting) { arm(session, due); }
+            return;
+        }
+
+        // Sets the worker's timer to come back to a session. Later timers already set for it are ignored when they fire
+        void arm(ServerSession& session, Clock::time_point due) {
+            if (due < session.armed) {
+                session.armed = due;
+                timers.emplace(due, session.fd);
+            }
+            return;
+        }
+
+        // Sends every paced line that is now due
+        void fireTimers() {
+            Clock::time_point now = Clock::now();
+
+            while (!timers.empty() && timers.top().first <= now) {
+                pair<Clock::time_point, int> timer = timers.top();
+                timers.pop();
+
+                auto found = sessions.find(timer.second);
+                if (found == sessions.end() || found->second->armed != timer.first) { continue; }
+                ServerSession& session = *found->second;
+                session.armed = Clock::time_point::max();
+
+                while (session.pacedNext < session.paced.size() && session.paced[session.pacedNext].first <= now) {
+                    session.output += session.paced[session.pacedNext++].second;
+                    session.output += '\n';
+                }
+                if (session.pacedNext == session.paced.size()) {
+                    session.paced.clear();
+                    session.pacedNext = 0;
+                }
+                else {
+                    arm(session, session.paced[session.pacedNext].first);
+                }
+
+                send(session);
+                if (session.dead) { closeSession(session); }
+            }
+            return;
+        }
+
+        // Writes as much of the output as the socket will take, and watches for room for the rest
+        void send(ServerSession& session) {
+            if (session.dead) { return; }
+
+            size_t sent = 0;
+            while (sent < session.output.size()) {
+                ssize_t wrote = ::send(session.fd, session.output.data() + sent, session.output.size() - sent, MSG_NOSIGNAL);
+                if (wrote < 0) {
+                    if (errno == EINTR) { continue; }
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) { break; }
+                    session.dead = true;
+                    return;
+                }
+                sent += wrote;
+            }
+            session.output.erase(0, sent);
+
+            bool blocked = !session.output.empty();
+            if (blocked != session.writing) {
+                epoll_event event = {};
+                event.events = EPOLLIN | (blocked ? (uint32_t)EPOLLOUT : 0u);
+                event.data.fd = session.fd;
+                epoll_ctl(epollFd, EPOLL_CTL_MOD, session.fd, &event);
+                session.writing = blocked;
+            }
+            return;
+        }
+
+        void closeSession(ServerSession& session) {
+            int fd = session.fd;
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+            close(fd);
+            sessions.erase(fd);
+            serverOpen--;
+            return;
+        }
+
+        int listenFd;
+        int epollFd = -1;
+        Rules rules;
+        ServerOptions options;
+        Clock::duration pace;
+
+        unordered_map<int, unique_ptr<ServerSession>> sessions;     // By socket
+        priority_queue<pair<Clock::time_point, int>, vector<pair<Clock::time_point, int>>, greater<pair<Clock::time_point, int>>> timers;
+};
+
+// Hosts tables until interrupted: "blackjack serve --port 7777 --threads 4 --pace 0"
+bool runServer(int argc, char* argv[]) {
+    ServerOptions options;
+    options.port = argValue(argc, argv, "port", options.port);
+    options.unixPath = argText(argc, argv, "unix", "");
+    options.threads = max(1, (int)argValue(argc, argv, "threads", max(1u, thread::hardware_concurrency())));
+    options.paceMs = max(0, (int)argValue(argc, argv, "pace", options.paceMs));
+    options.chips = max(1, (int)argValue(argc, argv, "chips", options.chips));
+    options.seed = argValue(argc, argv, "seed", options.seed);
+    options.seconds = max(0, (int)argValue(argc, argv, "seconds", 0));
+    Rules rules = rulesFromArgs(argc, argv);
+
+    raiseFileLimit();
+    int listener = listenSocket(options);
+    if (listener < 0) {
+        cout << "Could not listen on " << (options.unixPath.empty() ? "port " + to_string(options.port) : options.unixPath) << endl;
+        return false;
+    }
+
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+    cout << "Serving " << ruleName(rules) << " tables on " << (options.unixPath.empty() ? "127.0.0.1:" + to_string(options.port) : options.unixPath)
+         << " with " << options.threads << (options.threads == 1 ? " thread" : " threads") << endl;
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < options.threads; t++) {
+        workers.emplace_back([listener, &rules, &options]() { ServerWorker(listener, rules, options).run(); });
+    }
+
+    while (!serverStopping) {
+        this_thread::sleep_for(chrono::milliseconds(100));
+        if (options.seconds > 0 && chrono::steady_clock::now() - start >= chrono::seconds(options.seconds)) { serverStopping = 1; }
+    }
+    for (thread& worker : workers) { worker.join(); }
+    close(listener);
+    if (!options.unixPath.empty()) { unlink(options.unixPath.c_str()); }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Served " << serverSessions.load() << " sessions and " << serverRounds.load() << " rounds in " << seconds << " seconds, using "
+         << processCpuSeconds() << " CPU seconds" << endl;
+    return true;
+}
+
+/**********************
+ * The load generator plays many sessions against a server at once, each betting the minimum and playing
+ * like the dealer, and times every answer: from sending a command to getting the line that asks for the
+ * next one. Set the server's --pace to 0 to measure the server rather than its pauses.
+ **********************/
+
+// One connection the load generator plays
+struct LoadSession {
+    int fd = -1;
+    string input;
+    int rounds = 0;
+    chrono::steady_clock::time_point sent;
+};
+
+// What one load thread saw
+struct LoadResult {
+    LatencyHistogram latency;
+    long long rounds = 0;
+    long long errors = 0;
+    long long failed = 0;       // Sessions that couldn't connect or were dropped
+};
+
+// Sends a line, blocking until the socket has taken all of it. The load sessions only ever send a few bytes
+bool sendLine(int fd, const string& line) {
+    string text = line + "\n";
+    size_t sent = 0;
+    while (sent < text.size()) {
+        ssize_t wrote = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (wrote < 0 && (errno == EAGAIN || errno == EINTR)) { continue; }
+        if (wrote <= 0) { return false; }
+        sent += wrote;
+    }
+    return true;
+}
+
+// Reads a value such as "total=15" out of a line from the server
+int lineValue(const string& line, const string& name) {
+    size_t at = line.find(" " + name + "=");
+    return at == string::npos ? 0 : atoi(line.c_str() + at + name.size() + 2);
+}
+
+// Plays a share of the sessions on one epoll loop until each has played its rounds
+LoadResult runLoadThread(int numSessions, int numRounds, int port, const string& unixPath) {
+    LoadResult result;
+    int epollFd = epoll_create1(0);
+    unordered_map<int, LoadSession> sessions;
+
+    for (int i = 0; i < numSessions; i++) {
+        int fd = connectSocket(port, unixPath);
+        if (fd < 0) { result.failed++; continue; }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        LoadSession& session = sessions[fd];
+        session.fd = fd;
+        session.sent = chrono::steady_clock::now();
+
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    auto finish = [&](LoadSession& session, bool dropped) {
+        if (dropped) { result.failed++; }
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, session.fd, nullptr);
+        close(session.fd);
+        sessions.erase(session.fd);
+    };
+
+    int minBet = 0;     // Read from the server's greeting
+    epoll_event events[256];
+    while (!sessions.empty()) {
+        int ready = epoll_wait(epollFd, events, 256, 1000);
+        for (int e = 0; e < ready; e++) {
+            auto found = sessions.find(events[e].data.fd);
+            if (found == sessions.end()) { continue; }
+            LoadSession& session = found->second;
+
+            char buffer[4096];
+            bool closed = false;
+            while (true) {
+                ssize_t got = recv(session.fd, buffer, sizeof(buffer), 0);
+                if (got > 0) { session.input.append(buffer, got); continue; }
+                closed = got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+                break;
+            }
+
+            // Answer every line that asks for a move, and time how long it took to arrive
+            bool done = false;
+            size_t start = 0, end;
+            string reply;
+            while (!done && (end = session.input.find('\n', start)) != string::npos) {
+                string line = session.input.substr(start, end - start);
+                start = end + 1;
+                string word = line.substr(0, line.find(' '));
+
+                if (word == "HELLO") {
+                    minBet = lineValue(line, "min");
+                    reply = "BET " + to_string(minBet);
+                    continue;
+                }
+                if (word == "ERROR") { result.errors++; }
+                if (word != "INSURANCE" && word != "TURN" && word != "RESULT") { continue; }
+
+                auto now = chrono::steady_clock::now();
+                result.latency.add(chrono::duration_cast<chrono::nanoseconds>(now - session.sent).count());
+
+                if (word == "INSURANCE") { reply = "INSURE 0"; }
+                else if (word == "TURN") { reply = lineValue(line, "total") < 17 ? "HIT" : "STAND"; }
+                else if (++session.rounds < numRounds) { reply = "BET " + to_string(minBet); result.rounds++; }
+                else { result.rounds++; done = true; }
+            }
+            session.input.erase(0, start);
+
+            if (done) { finish(session, false); continue; }
+            if (!reply.empty()) {
+                session.sent = chrono::steady_clock::now();
+                if (!sendLine(session.fd, reply)) { closed = true; }
+            }
+            if (closed) { finish(session, true); }
+        }
+    }
+
+    close(epollFd);
+    return result;
+}
+
+// Asks the server for its counters with STATS. Returns false if it can't be reached
+bool serverStats(int port, const string& unixPath, long long& rounds, double& cpuSeconds) {
+    int fd = connectSocket(port, unixPath);
+    if (fd < 0 || !sendLine(fd, "STATS")) { return false; }
+
+    string input;
+    char buffer[1024];
+    ssize_t got;
+    while ((got = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        input.append(buffer, got);
+        size_t at = input.find("STATS ");
+        if (at != string::npos && input.find('\n', at) != string::npos) {
+            rounds = atoll(input.c_str() + input.find("rounds=", at) + 7);
+            cpuSeconds = atof(input.c_str() + input.find("cpu=", at) + 4);
+            close(fd);
+            return true;
+        }
+    }
+    close(fd);
+    return false;
+}
+
+// Plays many sessions against a server and reports the rounds per second, the answer latencies and how
+// many sessions each core of the server could hold
+bool loadTest(int argc, char* argv[]) {
+    int port = argValue(argc, argv, "port", 7777);
+    string unixPath = argText(argc, argv, "unix", "");
+    int numSessions = max(1, (int)argValue(argc, argv, "sessions", 1000));
+    int numRounds = max(1, (int)argValue(argc, argv, "rounds", 100));
+    int numThreads = max(1, min((int)argValue(argc, argv, "threads", 2), numSessions));
+
+    raiseFileLimit();
+    long long roundsBefore = 0, roundsAfter = 0;
+    double cpuBefore = 0, cpuAfter = 0;
+    if (!serverStats(port, unixPath, roundsBefore, cpuBefore)) {
+        cout << "Could not reach a server on " << (unixPath.empty() ? "port " + to_string(port) : unixPath) << endl;
+        return false;
+    }
+
+    auto start = chrono::steady_clock::now();
+    vector<LoadResult> results(numThreads);
+    vector<thread> threads;
+    for (int t = 0; t < numThreads; t++) {
+        int share = numSessions / numThreads + (t < numSessions % numThreads);
+        threads.emplace_back([&results, t, share, numRounds, port, &unixPath]() { results[t] = runLoadThread(share, numRounds, port, unixPath); });
+    }
+    for (thread& t : threads) { t.join(); }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    serverStats(port, unixPath, roundsAfter, cpuAfter);
+
+    LoadResult total;
+    for (const LoadResult& r : results) {
+        total.latency.merge(r.latency);
+        total.rounds += r.rounds;
+        total.errors += r.errors;
+        total.failed += r.failed;
+    }
+
+    // The server's CPU time over the run says how many cores it kept busy
+    double cores = (cpuAfter - cpuBefore) / seconds;
+    cout << "Played " << total.rounds << " rounds over " << numSessions << " sessions in " << seconds << " seconds ("
+         << (long long)(total.rounds / seconds) << " rounds/sec)" << endl;
+    cout << "Answer latency: p50 " << total.latency.quantile(0.5) / 1000.0 << " us, p99 " << total.latency.quantile(0.99) / 1000.0
+         << " us, p99.9 " << total.latency.quantile(0.999) / 1000.0 << " us, max " << total.latency.high / 1000.0 << " us" << endl;
+    cout << "Server: " << roundsAfter - roundsBefore << " rounds on " << cores << " cores, " << (long long)(numSessions / max(cores, 1e-3))
+         << " sessions and " << (long long)((roundsAfter - roundsBefore) / max(cpuAfter - cpuBefore, 1e-6)) << " rounds/sec per core" << endl;
+    if (total.errors || total.failed) { cout << total.errors << " errors, " << total.failed << " sessions dropped" << endl; }
+    return total.failed == 0;
+}
+
+#else
+
+bool runServer(int, char*[]) {
+    cout << "The table server needs epoll, which only Linux has" << endl;
+    return false;
+}
+
+bool loadTest(int, char*[]) {
+    cout << "The load generator needs epoll, which only Linux has" << endl;
+    return false;
+}
+
+#endif
+
+/**********************
+ * Benchmarks for the game core. Each case reports nanoseconds per operation and heap allocations per
+ * operation, and the end to end rounds also report hands per second. With --baseline, every case is also
+ * run against a copy of the code as it was before the engine existed, so improvements can be seen side by
+ * side. With --json, the results are printed in a fixed format that can be saved and compared between versions.
+ **********************/
+
+// Every allocation made through operator new on this thread. Read by the benchmarks
+thread_local long long allocationCount = 0;
+
+// Counts the allocation, then gets the memory from malloc like the standard operator new does
+void* operator new(size_t size) {
+    allocationCount++;
+    void* memory = malloc(size ? size : 1);
+    if (!memory) { throw bad_alloc(); }
+    return memory;
+}
+
+// Kept out of line so the compiler doesn't mistake freeing memory from the operator new above for a mismatch
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void releaseMemory(void* memory) noexcept { free(memory); }
+
+void operator delete(void* memory) noexcept { releaseMemory(memory); }
+void operator delete(void* memory, size_t) noexcept { releaseMemory(memory); }
+
+// The game core as it was first written, kept so the benchmarks can compare against it. The only change is
+// that total() no longer pauses for a second on a bust
+namespace baseline {
+    class Card {
+        public:
+            int value;
+            int suit;
+
+            Card (int v, int s) : value(v), suit(s) {}
+    };
+
+    class Deck {
+        public:
+            Deck() {
+                for (int i = 1; i <= 13; i++) {
+                    for (int j = 1; j <= 4; j++) {
+                        cards.push_back(Card(i, j));
+                        numCards += 1;
+                    }
+                }
+                return;
+            }
+
+            void transferCard(vector<Card> &destination) {
+                if (cards.empty()) {
+                    cout << "Deck is empty! Cannot transfer a card." << endl;
+                    return;
+                }
+
+                destination.push_back(cards[0]);
+                cards.erase(cards.begin());
+
+                return;
+            }
+
+            void combine(const Deck &deck2) {
+                numCards += deck2.numCards;
+                cards.insert(cards.end(), deck2.cards.begin(), deck2.cards.end());
+
+                return;
+            }
+
+            void addCards(const vector<Card> &source) {
+                numCards += source.size();
+                cards.insert(cards.end(), source.begin(), source.end());
+
+                return;
+            }
+
+            void shuffle() {
+                unsigned seed = chrono::system_clock::now().time_since_epoch().count();
+                std::shuffle(std::begin(cards), std::end(cards), default_random_engine(seed));
+
+                cout << "The deck has been shuffled." << endl;
+                return;
+            }
+
+            bool empty() const { return cards.empty(); }
+
+        private:
+            vector<Card> cards;
+            int numCards = 0;
+    };
+
+    int payout(int bet, int total, int numCards) {
+        if (total == 21 && numCards == 2) {
+            return bet + (bet * 1.5);
+        }
+
+        return (bet * 2);
+    }
+
+    bool total(vector<Card> hand) {
+        int total1 = 0, total2 = 0;
+        bool ace = false;
+
+        for (size_t i = 0; i < hand.size(); i++) {
+            if (hand[i].value == 1) {
+                total1 += 11;
+                total2 += 1;
+                ace = true;
+            }
+            else if (hand[i].value > 10) {
+                total1 += 10;
+                total2 += 10;
+            }
+            else {
+                total1 += hand[i].value;
+                total2 += hand[i].value;
+            }
+        }
+
+        if (total2 <= 21) {
+            cout << endl << "You have ";
+            if (ace && (total1 == 21)) {
+                cout << total1 << endl;
+            }
+            else if (ace && (total1 <= 21)) {
+                cout << total1 << " or " << total2 << endl;
+            }
+            else {
+                cout << total2 << endl;
+            }
+
+            return false;
+        }
+        else {
+            cout << total2 << ", too many!" << endl;
+            return true;
+        }
+    }
+
+    void sendAllCards(vector<vector<Card>>& seats, vector<Card>& destination) {
+        for (auto& seat : seats) {
+            for (auto& card : seat) {
+                destination.push_back(card);
+            }
+        }
+    }
+
+    // The best total of a hand, counted the way total() counts it but without printing
+    int bestTotal(const vector<Card>& hand) {
+        int sum = 0;
+        bool ace = false;
+        for (const Card& card : hand) {
+            sum += (card.value > 10 ? 10 : card.value);
+            ace = ace || card.value == 1;
+        }
+        return (ace && sum <= 11) ? sum + 10 : sum;
+    }
+
+    // A headless round built from the original pieces: the player hits until 17 like the dealer, then the
+    // dealer plays and the hand is paid with payout(). Cards are collected with sendAllCards() and the boot is
+    // refilled with addCards() once the discard pile holds more than 160 cards
+    struct Table {
+        Deck boot;
+        vector<Card> discardPile;
+
+        Table() {
+            boot.combine(Deck());
+            boot.combine(Deck());
+            boot.combine(Deck());
+            boot.shuffle();
+        }
+
+        int playRound(int bet) {
+            vector<vector<Card>> seats(2);
+            vector<Card>& yourHand = seats[0];
+            vector<Card>& dealerHand = seats[1];
+
+            boot.transferCard(yourHand);
+            boot.transferCard(dealerHand);
+            boot.transferCard(yourHand);
+            boot.transferCard(dealerHand);
+
+            bool bust = total(yourHand);
+            while (!bust && bestTotal(yourHand) < 17) {
+                boot.transferCard(yourHand);
+                bust = total(yourHand);
+            }
+
+            int won = 0;
+            if (!bust) {
+                while (bestTotal(dealerHand) < 17) { boot.transferCard(dealerHand); }
+
+                int mine = bestTotal(yourHand), theirs = bestTotal(dealerHand);
+                if (theirs > 21 || mine > theirs) { won = payout(bet, mine, yourHand.size()); }
+                else if (mine == theirs) { won = bet; }
+            }
+
+            sendAllCards(seats, discardPile);
+            if (discardPile.size() > 160) {
+                boot.addCards(discardPile);
+                discardPile.clear();
+                boot.shuffle();
+            }
+
+            return won - bet;
+        }
+    };
+}
+
+// Throws away anything written to it, so printing code can be timed without filling the screen
+struct NullBuffer : streambuf {
+    int overflow(int c) { return c; }
+    streamsize xsputn(const char*, streamsize n) { return n; }
+};
+
+// One benchmark result
+struct BenchResult {
+    string name;
+    string variant;         // "current" or "baseline"
+    long long ops = 0;
+    double nsPerOp = 0;
+    double allocationsPerOp = 0;
+    double handsPerSec = 0; // Only for the end to end rounds
+};
+
+// Results are fed into here so the compiler can't throw the work away
+volatile long long benchSink = 0;
+
+// Times a benchmark body that performs 'ops' operations, after one untimed warm up run
+template <class Body>
+BenchResult measure(const string& name, const string& variant, long long ops, Body body) {
+    body(max(1LL, ops / 10));
+
+    long long allocationsBefore = allocationCount;
+    auto start = chrono::steady_clock::now();
+    body(ops);
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    long long allocations = allocationCount - allocationsBefore;    // Read before the name is copied, which can allocate
 
-        // Constructor that will set the value and suit of each card
-        Card (int v, int s) : value(v), suit(s) {} 
+    BenchResult result;
+    result.name = name;
+    result.variant = variant;
+    result.ops = ops;
+    result.nsPerOp = ns / ops;
+    result.allocationsPerOp = (double)allocations / ops;
+    return result;
+}
 
-        // Allows the value and suit of a card to be printed using '<<'
-        friend ostream& operator<<(ostream& os, const Card& card) {
-            // Define arrays to store rank and suit strings
-            const string ranks[] = { "Ace", "2", "3", "4", "5", "6", "7", "8", "9", "10", "Jack", "Queen", "King" };
-            const string suits[] = { "Clubs", "Spades", "Diamonds", "Hearts" };
+// A few hands that don't bust, used to time the hand totals
+const int BENCH_HANDS[][4] = { { 1, 6, 0, 0 }, { 10, 7, 0, 0 }, { 2, 3, 4, 5 }, { 1, 1, 9, 0 }, { 13, 1, 0, 0 }, { 5, 5, 10, 0 } };
 
-            // Check if rank and suit values are within the valid ranges
-            if (card.value < 1 || card.value > 13 || card.suit < 1 || card.suit > 4) {
-                os << "Invalid card! Something went wrong.\n";
-            }
-            else {
-                // Output the formatted card information
-                os << ( card.value == 1 ? "an " : "a ") << ranks[card.value - 1] << " of " << suits[card.suit - 1];
-            }
+vector<BenchResult> benchCurrent(long long scale) {
+    vector<BenchResult> results;
+    Xoshiro256 gen(1);
 
-            return os;
+    results.push_back(measure("deck_build", "current", scale / 100, [](long long ops) {
+        for (long long i = 0; i < ops; i++) { benchSink += Shoe(4).remaining(); }
+    }));
+
+    results.push_back(measure("deck_combine", "current", scale / 100, [](long long ops) {
+        Deck extra;
+        for (long long i = 0; i < ops; i++) {
+            Deck boot;
+            boot.combine(extra);
+            boot.combine(extra);
+            boot.combine(extra);
+            benchSink += boot.remaining();
         }
-};
+    }));
 
-// Class used for generating and managing a deck of cards
-class Deck {
-    public:
-        // Generates one of each card and stores the result in a vector
-        Deck() {
-            for (int i = 1; i <= 13; i++) {
-                for (int j = 1; j <= 4; j++) {
-                    cards.push_back(Card(i, j));
-                    numCards += 1;
-                }
-            }
-            return;
+    results.push_back(measure("deck_shuffle", "current", scale / 100, [&gen](long long ops) {
+        Shoe boot(4);
+        for (long long i = 0; i < ops; i++) {
+            boot.reshuffle(gen);
+            benchSink += boot.peek().value;
         }
+    }));
 
-        // Adds the standard 52 cards to a deck
-        void fillDeck() {
-            for (int i = 1; i <= 13; i++) {
-                for (int j = 1; j <= 4; j++) {
-                    cards.push_back(Card(i, j));
-                    numCards += 1;
+    // Dealing down to the cut card and reshuffling, the way a table goes through a boot
+    for (ShuffleMode mode : { FULL_SHUFFLE, LAZY_SHUFFLE }) {
+        Rules rules;
+        string name = mode == FULL_SHUFFLE ? "shoe_full" : "shoe_lazy";
+        results.push_back(measure(name, "current", scale / 100, [&rules, mode](long long ops) {
+            Shoe boot(rules.numDecks);
+            Xoshiro256 shuffler(1);
+            for (long long i = 0; i < ops; i++) {
+                if (mode == FULL_SHUFFLE) { boot.reshuffle(shuffler); }
+                else { boot.collect(); }
+
+                while (boot.dealt() <= rules.reshuffleAt) {
+                    benchSink += mode == FULL_SHUFFLE ? boot.deal().value : boot.dealRandom(shuffler).value;
                 }
             }
+        }));
+    }
 
-            return;
+    results.push_back(measure("transfer_card", "current", scale, [](long long ops) {
+        Deck boot(4);
+        vector<Card> hand;
+        hand.reserve(208);
+        for (long long i = 0; i < ops; i++) {
+            if (boot.empty()) {
+                boot.addCards(hand);
+                hand.clear();
+            }
+            boot.transferCard(hand);
         }
+        benchSink += hand.size();
+    }));
 
-        // Transfers the top card from the deck to a given vector
-        void transferCard(vector<Card> &destination) {
-            if (cards.empty()) {
-                cout << "Deck is empty! Cannot transfer a card." << endl;
-                return;
-            } // Check that our deck is not empty
+    results.push_back(measure("total", "current", scale, [](long long ops) {
+        vector<vector<Card>> hands;
+        for (const auto& values : BENCH_HANDS) {
+            hands.emplace_back();
+            for (int v : values) { if (v) { hands.back().push_back(Card(v, 1)); } }
+        }
+        for (long long i = 0; i < ops; i++) { benchSink += handValue(hands[i % hands.size()]).total(); }
+    }));
 
-            destination.push_back(cards[0]);    // Transfer the first card to the destination
-            cards.erase(cards.begin());         // Remove the first card from the deck
+    results.push_back(measure("payout", "current", scale, [](long long ops) {
+        for (long long i = 0; i < ops; i++) { benchSink += payout(5 + (i & 63), 21, 2 + (i & 1)); }
+    }));
 
-            return;
+    results.push_back(measure("send_all_cards", "current", scale / 10, [](long long ops) {
+        vector<vector<Card>> seats(7, vector<Card>(3, Card(10, 1)));
+        vector<Card> discardPile;
+        for (long long i = 0; i < ops; i++) {
+            sendAllCards(seats, discardPile);
+            if (discardPile.size() > 160) { discardPile.clear(); }
         }
+        benchSink += discardPile.size();
+    }));
 
-        // Displays all cards within a deck
-        void showCards(){
-            for (int i = 0; i < numCards; i++) {
-                cout << cards[i] << endl;
-            }
+    // The games are set up outside the timed loop, so only the rounds themselves are counted
+    Game dealerGame(Rules(), 1);
+    BenchResult round = measure("round", "current", scale / 10, [&dealerGame](long long ops) {
+        Game& game = dealerGame;
+        DealerPolicy policy;
+        for (long long i = 0; i < ops; i++) { benchSink += playRound(game, policy).net; }
+    });
+    round.handsPerSec = 1e9 / round.nsPerOp;
+    results.push_back(round);
 
-            cout << "This deck has " << numCards << (numCards == 1 ? " card." : " cards." ) << endl;
-            return;
+    Game bookGame(Rules(), 1);
+    BenchResult bookRound = measure("round_book", "current", scale / 10, [&bookGame](long long ops) {
+        Game& game = bookGame;
+        BookPolicy policy;
+        for (long long i = 0; i < ops; i++) { benchSink += playRound(game, policy).net; }
+    });
+    bookRound.handsPerSec = 1e9 / bookRound.nsPerOp;
+    results.push_back(bookRound);
+
+    // The same book rounds with the policy behind an AnyPolicy, to show what a virtual call per question costs
+    // next to the inlined policy above, and the other bots inlined the same way
+    Game erasedGame(Rules(), 1);
+    AnyPolicy erasedBook = BookPolicy();
+    BenchResult erasedRound = measure("round_book_erased", "current", scale / 10, [&erasedGame, &erasedBook](long long ops) {
+        for (long long i = 0; i < ops; i++) { benchSink += playRound(erasedGame, erasedBook).net; }
+    });
+    erasedRound.handsPerSec = 1e9 / erasedRound.nsPerOp;
+    results.push_back(erasedRound);
+
+    Game countGame(Rules(), 1);
+    BenchResult countRound = measure("round_count", "current", scale / 10, [&countGame](long long ops) {
+        CountingPolicy<HiLo> policy;
+        for (long long i = 0; i < ops; i++) { benchSink += playRound(countGame, policy).net; }
+    });
+    countRound.handsPerSec = 1e9 / countRound.nsPerOp;
+    results.push_back(countRound);
+
+    Game randomGame(Rules(), 1);
+    BenchResult randomRound = measure("round_random", "current", scale / 10, [&randomGame](long long ops) {
+        RandomPolicy policy;
+        for (long long i = 0; i < ops; i++) { benchSink += playRound(randomGame, policy).net; }
+    });
+    randomRound.handsPerSec = 1e9 / randomRound.nsPerOp;
+    results.push_back(randomRound);
+
+    // One decision of the EV policy: every action valued for the exact cards left. The rounds are played to
+    // the book, so the calculator sees the same shoes from one run to the next, and keeps what it remembers
+    // between decisions the way the policy does
+    Game evGame(Rules(), 1);
+    EVCalculator evCalculator;
+    results.push_back(measure("ev_decision", "current", max(1LL, scale / 2000), [&evGame, &evCalculator](long long ops) {
+        BookPolicy book;
+        for (long long i = 0; i < ops; ) {
+            evGame.deal(evGame.getRules().minBet);
+            if (evGame.getPhase() == Game::INSURANCE) { evGame.insure(0); }
+            while (evGame.getPhase() == Game::PLAYER_TURN) {
+                benchSink += evCalculator.evaluate(evGame).best();
+                i++;
+                if (!evGame.act(book.action(evGame))) { evGame.act(STAND); }
+            }
+            evGame.endRound();
         }
+    }));
 
-        // Combines two decks of cards
-        void combine(const Deck &deck2) {
-            numCards += deck2.numCards;
-            cards.insert(cards.end(), deck2.cards.begin(), deck2.cards.end());
+    // The same rounds written to a hand history log that is thrown away, to show what logging costs
+    Game loggedGame(Rules(), 1);
+    HandLogFile nullLog;
+    if (nullLog.open(NULL_DEVICE, Rules(), 1)) {
+        HandLogWriter nullWriter(nullLog, 0);
+        BenchResult loggedRound = measure("round_logged", "current", scale / 10, [&loggedGame, &nullWriter](long long ops) {
+            HandLogWriter& log = nullWriter;
+            BookPolicy policy;
+            for (long long i = 0; i < ops; i++) { benchSink += playRound(loggedGame, policy, log).net; }
+        });
+        loggedRound.handsPerSec = 1e9 / loggedRound.nsPerOp;
+        results.push_back(loggedRound);
+    }
 
-            return;
+    // A full table plays seven hands every round
+    Table fullTable(Rules(), MAX_SEATS, 1);
+    BenchResult tableRound = measure("round_table", "current", scale / 50, [&fullTable](long long ops) {
+        BookPolicy policy;
+        for (long long i = 0; i < ops; i++) {
+            playRound(fullTable, policy);
+            benchSink += fullTable.getResult(0).net;
         }
+    });
+    tableRound.handsPerSec = 1e9 * MAX_SEATS / tableRound.nsPerOp;
+    results.push_back(tableRound);
 
-        void addCards(const vector<Card> &source) {
-            numCards += source.size();
-            cards.insert(cards.end(), source.begin(), source.end());
+    // A round at 256 tables in lockstep, with each set of kernels the CPU can run
+    const int batchSize = 256;
+    for (SimdLevel level : { SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512 }) {
+        if (!simdSupported(level)) { continue; }
 
-            return;
+        BatchTables batch(Rules(), batchSize, 1, level);
+        SimResult batchResult;
+        BenchResult batchRound = measure(string("batch_") + batch.kernelName(), "current", scale / 2000, [&batch, &batchResult](long long ops) {
+            for (long long i = 0; i < ops; i++) { batch.playRound(batchResult); }
+        });
+        batchRound.handsPerSec = 1e9 * batchSize / batchRound.nsPerOp;
+        results.push_back(batchRound);
+        benchSink += batchResult.net;
+    }
+
+    return results;
+}
+
+vector<BenchResult> benchBaseline(long long scale) {
+    using namespace baseline;
+    vector<BenchResult> results;
+
+    // The original code prints as it goes, so its output is thrown away while it is timed
+    NullBuffer nothing;
+    streambuf* screen = cout.rdbuf(&nothing);
+
+    results.push_back(measure("deck_build", "baseline", scale / 100, [](long long ops) {
+        for (long long i = 0; i < ops; i++) {
+            baseline::Deck boot = baseline::Deck();
+            baseline::Deck deck2 = baseline::Deck();
+            baseline::Deck deck3 = baseline::Deck();
+            baseline::Deck deck4 = baseline::Deck();
+            boot.combine(deck2);
+            boot.combine(deck3);
+            boot.combine(deck4);
+            benchSink += boot.empty();
         }
+    }));
 
-        // Shuffles a deck of cards, or two decks together
-        void shuffle() {
-            // Generate a new seed based on the current time
-            unsigned seed = chrono::system_clock::now().time_since_epoch().count();
+    results.push_back(measure("deck_combine", "baseline", scale / 100, [](long long ops) {
+        baseline::Deck extra;
+        for (long long i = 0; i < ops; i++) {
+            baseline::Deck boot;
+            boot.combine(extra);
+            boot.combine(extra);
+            boot.combine(extra);
+            benchSink += boot.empty();
+        }
+    }));
 
-            // Use the new seed to shuffle the cards
-            std::shuffle(std::begin(cards), std::end(cards), default_random_engine(seed));
+    results.push_back(measure("deck_shuffle", "baseline", scale / 100, [](long long ops) {
+        baseline::Deck boot;
+        boot.combine(baseline::Deck());
+        boot.combine(baseline::Deck());
+        boot.combine(baseline::Deck());
+        for (long long i = 0; i < ops; i++) { boot.shuffle(); }
+    }));
 
-            cout << "The deck has been shuffled." << endl;
-            return;
+    results.push_back(measure("transfer_card", "baseline", scale, [](long long ops) {
+        baseline::Deck boot;
+        boot.combine(baseline::Deck());
+        boot.combine(baseline::Deck());
+        boot.combine(baseline::Deck());
+        vector<baseline::Card> hand;
+        hand.reserve(208);
+        for (long long i = 0; i < ops; i++) {
+            if (boot.empty()) {
+                boot.addCards(hand);
+                hand.clear();
+            }
+            boot.transferCard(hand);
         }
+        benchSink += hand.size();
+    }));
 
-    private:
-        vector<Card> cards; // Stores all of the cards in the deck
-        int numCards = 0;   // How many cards are within the deck
-};
+    results.push_back(measure("total", "baseline", scale / 10, [](long long ops) {
+        vector<vector<baseline::Card>> hands;
+        for (const auto& values : BENCH_HANDS) {
+            hands.emplace_back();
+            for (int v : values) { if (v) { hands.back().push_back(baseline::Card(v, 1)); } }
+        }
+        for (long long i = 0; i < ops; i++) { benchSink += baseline::total(hands[i % hands.size()]); }
+    }));
 
-// Used to calculate the winnings for a player
-int payout(int bet, int total, int numCards) {
-    // If the player has blackjack
-    if (total == 21 && numCards == 2) {
-        return bet + (bet * 1.5);
-    }
+    results.push_back(measure("payout", "baseline", scale, [](long long ops) {
+        for (long long i = 0; i < ops; i++) { benchSink += baseline::payout(5 + (i & 63), 21, 2 + (i & 1)); }
+    }));
 
-    // If the player wins by regular means
-    return (bet * 2);
+    results.push_back(measure("send_all_cards", "baseline", scale / 10, [](long long ops) {
+        vector<vector<baseline::Card>> seats(7, vector<baseline::Card>(3, baseline::Card(10, 1)));
+        vector<baseline::Card> discardPile;
+        for (long long i = 0; i < ops; i++) {
+            baseline::sendAllCards(seats, discardPile);
+            if (discardPile.size() > 160) { discardPile.clear(); }
+        }
+        benchSink += discardPile.size();
+    }));
+
+    BenchResult round = measure("round", "baseline", scale / 100, [](long long ops) {
+        baseline::Table table;
+        for (long long i = 0; i < ops; i++) { benchSink += table.playRound(5); }
+    });
+    round.handsPerSec = 1e9 / round.nsPerOp;
+    results.push_back(round);
+
+    cout.rdbuf(screen);
+    return results;
 }
 
-// Calculates the total value in a player's hand. Will return true if the player busts, otherwise false
-bool total(vector<Card> hand) {
-    int total1 = 0, total2 = 0;
-    bool ace = false;
-
-    for (int i = 0; i < hand.size(); i++) {
-        if (hand[i].value == 1) {
-            total1 += 11;
-            total2 += 1;
-            ace = true;
-        } // If an Ace is found
-        else if (hand[i].value > 10) {
-            total1 += 10;
-            total2 += 10;
-        }  // If a face card is found
-        else { 
-            total1 += hand[i].value;
-            total2 += hand[i].value;
-        }
-    }
-
-    // Since total2 is always equal to or less than total1, we know the player is out by checking that value
-    if (total2 <= 21) {
-        cout << endl << "You have ";
-        if (ace && (total1 == 21)) {
-            cout << total1 << endl;
-        }
-        else if (ace && (total1 <= 21)) {
-            cout << total1 << " or " << total2 << endl;
-        } // If the player has an Ace
-        else {
-            cout << total2 << endl;
-        } // Otherwise, print total
+// Prints benchmark results as JSON. The keys and their order never change, so saved results can be compared
+void printBenchJson(const vector<BenchResult>& results) {
+    cout << "{" << endl;
+    cout << "  \"format\": 1," << endl;
+    cout << "  \"results\": [" << endl;
 
-        return false;
-    }
-    else {
-        cout << total2 << ", too many!" << endl;
-        this_thread::sleep_for(chrono::seconds(1));
-        return true;
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        char line[256];
+        snprintf(line, sizeof(line),
+            "    {\"name\": \"%s\", \"variant\": \"%s\", \"ops\": %lld, \"ns_per_op\": %.3f, \"allocs_per_op\": %.4f, \"hands_per_sec\": %.0f}%s",
+            r.name.c_str(), r.variant.c_str(), r.ops, r.nsPerOp, r.allocationsPerOp, r.handsPerSec, i + 1 < results.size() ? "," : "");
+        cout << line << endl;
     }
+
+    cout << "  ]" << endl;
+    cout << "}" << endl;
+    return;
 }
 
-void sendCard(vector<Card>& hand, vector<Card>& destination) {
-    if (!hand.empty()) {
-        destination.push_back(hand[0]); // Transfer the first card to the destination
-        hand.erase(hand.begin()); // Remove the first card from the deck
-    } else {
-        cout << "Hand is empty! Cannot transfer a card." << endl;
-    }
+// Prints benchmark results as a table
+void printBenchTable(const vector<BenchResult>& results) {
+    char line[256];
+    snprintf(line, sizeof(line), "%-16s %-9s %14s %14s %16s", "case", "variant", "ns/op", "allocs/op", "hands/sec");
+    cout << line << endl;
 
+    for (const BenchResult& r : results) {
+        snprintf(line, sizeof(line), "%-16s %-9s %14.2f %14.4f %16s", r.name.c_str(), r.variant.c_str(), r.nsPerOp,
+            r.allocationsPerOp, r.handsPerSec > 0 ? to_string((long long)r.handsPerSec).c_str() : "-");
+        cout << line << endl;
+    }
     return;
 }
 
-void sendAllCards(vector<vector<Card>>& seats, vector<Card>& destination) {
-    for (auto& seat : seats) {
-        for (auto& card : seat) {
-            destination.push_back(card); // Transfer card from each seat to destination
+// Runs the benchmarks. --scale sets how many operations the cheapest cases run. With --check, returns false if
+// a round of the current engine touched the heap once it was warmed up
+bool benchmark(int argc, char* argv[]) {
+    long long scale = argValue(argc, argv, "scale", 2000000);
+    bool json = hasFlag(argc, argv, "json");
+
+    vector<BenchResult> results = benchCurrent(scale);
+
+    if (hasFlag(argc, argv, "baseline")) {
+        vector<BenchResult> before = benchBaseline(scale);
+
+        // Show each baseline result right after the current one of the same name
+        vector<BenchResult> merged;
+        for (const BenchResult& r : results) {
+            merged.push_back(r);
+            for (const BenchResult& b : before) {
+                if (b.name == r.name) { merged.push_back(b); }
+            }
         }
+        results = merged;
     }
-}
 
-void bookMove(vector<Card> yourHand, vector<Card> dealerHand) {
-    
-    // Will recommend hitting or standing,
-    // hit when hand is 11 or less
-    // when your hand is 12-16: if the dealer's card is 7 or higher, it is recommended to hit. If 6 or lower, you may choose to stand since the dealer has a higher chance of busting
-    // if you have a soft 18, its often best to stand, unless the dealer has 9, 10, or ace
-    // If you have a pair of aces or 8s, it is recommended to split these pairs. if splitting isn't an option, then hit instead
-    // if your total hand is 17 or lower, its generally recommended to hit unless the dealer's upcard is weak (4-6)
-
-    // when to double down,
-    // when your hand total is 9: if the dealer's card is 2-6, doubling down is recommended
-    // When your hand total is 10: doubling down is recommended when the dealer has 2-9, as you have a strong chance of winning with a total of 20 or 21
-    // when your hand total is 11: it's almost always recommended to double down with a total of 11, regardless of the dealer's upcard
-    // when you have a soft 16-18: if the dealer's card is weak (4-6), it's recommended to double down on soft 16-18. This is because drawing a 10 won't make you bust, and you have a good chance at improving your hand
-
-    // when to split pairs  
-    // pairs of aces or 8s: always split. most casinos only allow you to draw one additional card per split ace
-    // pairs of 2s, 3s, 6s, 7s: split these when the dealer's card is weak (2-7). this gives you a chance to improve your hand against a dealer who is more likely to bust
-    // pairs of 9s: split 9s when the dealer's upcard is weak (2-6, 8, 9). However, when up against a 7, 10, or Ace, it is better to stand
-    // pairs of 4s: split when the dealer's card is weak (5-6)
-    // never split 5s or 10s!
-    return;
+    if (json) { printBenchJson(results); }
+    else { printBenchTable(results); }
+
+    if (hasFlag(argc, argv, "check")) {
+        for (const BenchResult& r : results) {
+            if (r.variant == "current" && r.handsPerSec > 0 && r.allocationsPerOp > 0) {
+                cerr << r.name << " allocated " << r.allocationsPerOp << " times per round" << endl;
+                return false;
+            }
+        }
+    }
+    return true;
 }
 
 
@@ -335,27 +7297,74 @@ void yourTurn(Seat seat) {
 }
 */
 
-void blackjack() {
-    int chips = 20, bet = 0, insurance = -1, numCards = 0;
-    bool playing = false, placeInsurance = false;
-    vector<Card> yourHand, dealerHand, discardPile;
+// Tells the player what insurance is worth from the cards they haven't seen. Against a blackjack, insuring for
+// half the bet is even money
+void showInsuranceAdvice(GameSink& out, const InsuranceOdds& odds, bool blackjack, const Rules& rules) {
+    out.gap();
+    out.say(EVENT_ADVICE, odds.tens, " of the ", odds.cards, " cards you haven't seen are tens, so the dealer has blackjack ",
+            100.0 * odds.tenChance(), "% of the time.");
+    out.say(EVENT_ADVICE, "Expected chips won per chip of insurance: ", (odds.ev() >= 0 ? "+" : ""), odds.ev());
+    if (blackjack) {
+        out.say(EVENT_ADVICE, "Expected chips won per chip bet: Even Money +", odds.evenMoneyEV(rules.sixToFive), "  Keep Blackjack +",
+                odds.blackjackEV(rules.sixToFive));
+    }
+    out.say(EVENT_ADVICE, odds.worthTaking() ? "The odds say you should take " : "The odds say you should not take ",
+            blackjack ? "even money." : "insurance.");
+    return;
+}
 
-    const int NUM_SEATS = 7;
-    vector<vector<Card>> seats(NUM_SEATS); // A vector of vectors to represent seats
+// Prints how a hand turned out once the round is over
+void showOutcome(GameSink& out, const PlayerHand& hand, int numHands, int index) {
+    string prefix = numHands > 1 ? "Hand " + to_string(index + 1) + ": " : "";
 
-    Deck boot = Deck();
-    Deck deck2 = Deck();
-    Deck deck3 = Deck();
-    Deck deck4 = Deck();
+    switch (hand.outcome) {
+        case BLACKJACK: out.say(EVENT_OUTCOME, prefix, "Blackjack! You win ", hand.won - hand.bet, " chips."); break;
+        case WIN: out.say(EVENT_OUTCOME, prefix, "You win ", hand.won - hand.bet, " chips!"); break;
+        case PUSH: out.say(EVENT_OUTCOME, prefix, "It's a push. Your bet of ", hand.bet, " chips is returned."); break;
+        case LOSS: out.say(EVENT_OUTCOME, prefix, "The dealer wins. You lose ", hand.bet, " chips."); break;
+        case BUST: out.say(EVENT_OUTCOME, prefix, "Busted :( You lose ", hand.bet, " chips."); break;
+        case SURRENDERED: out.say(EVENT_OUTCOME, prefix, "You surrender and lose ", hand.bet - hand.won, " chips."); break;
+        default: break;
+    }
 
-    // The game starts by having the dealer combine four decks, then shuffle them all into a boot
-    boot.combine(deck2);
-    boot.combine(deck3);
-    boot.combine(deck4);
+    return;
+}
+
+// Reads a number typed by the player, showing them the question first. Anything that isn't a number reads
+// as 'invalid'. Returns false once there is no more input to read
+bool readNumber(GameSink& out, int& value, int invalid) {
+    out.flush();
+    cin >> value;
+
+    // Clears the input buffer to prevent infinite loops
+    if (!cin) {
+        value = invalid;
+        if (cin.eof()) { return false; }
+    }
+    cin.clear();
+    cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    return true;
+}
+
+// Plays the interactive game at the console. All of the rules are handled by the Game engine, and everything
+// shown to the player goes to 'out'
+void blackjack(GameSink& out, uint64_t seed) {
+    int chips = 20;
+    bool playing = true;
+
+    Rules rules;
+    Game game(rules, seed);
+    EVCalculator calculator(rules);     // Values each action for the Help option
+
+    // Where to write the metrics of an instrumented build, if anywhere
+    const char* metricsJson = getenv("BLACKJACK_METRICS_JSON");
+    const char* metricsProm = getenv("BLACKJACK_METRICS_PROM");
 
-    cout << endl << "Shuffling deck..." << endl;
-    this_thread::sleep_for(chrono::seconds(2));
-    boot.shuffle();
+    // The game starts by having the dealer combine four decks, then shuffle them all into a boot
+    out.gap();
+    out.say(EVENT_SHUFFLE, "Shuffling deck...");
+    out.pause(2000);
+    out.say(EVENT_SHUFFLE, "The deck has been shuffled.");
 
     /*
     // Prompt the player to choose a seat
@@ -377,207 +7386,267 @@ void blackjack() {
 
     // ********************************************************************* //
 
-    cout << endl << "Welcome to Blackjack! Bets start at 5 chips and go up to 300." << endl;
+    out.gap();
+    out.say(EVENT_MESSAGE, "Welcome to Blackjack! Bets start at ", rules.minBet, " chips and go up to ", rules.maxBet, ".");
 
-    // Bets are placed initially
-    while ((bet < 5) || (bet > 300) && !(cin >> bet)) {
-        cout << "You have " << chips << " chips." << " How much will you bet?" << endl;
-        cin >> bet;
+    while (playing) {
+        int bet = 0, insurance = -1;
 
-        // Clears the input buffer to prevent infinite loops
-        cin.clear();
-        cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        // Bets are placed initially
+        while (bet < rules.minBet || bet > rules.maxBet || bet > chips) {
+            out.say(EVENT_PROMPT, "You have ", chips, " chips. How much will you bet?");
 
-        
-        // Let the player know what they did wrong
-        cout << endl;
-        if (bet < 5) { cout << "You must bet at least 5 chips to play!" << endl; }
-        if (bet > 300) { cout << "You cannot bet more than 300 chips at this table!" << endl; }
-    }
+            // Give up if there is no more input to read
+            if (!readNumber(out, bet, 0)) {
+                out.say(EVENT_MESSAGE, "Closing the game.");
+                out.endRound();
+                return;
+            }
 
-    chips -= bet;
-    //cout << "All bets have been placed!" << endl;
+            // Let the player know what they did wrong
+            out.gap();
+            if (bet < rules.minBet) { out.say(EVENT_MESSAGE, "You must bet at least ", rules.minBet, " chips to play!"); }
+            else if (bet > rules.maxBet) { out.say(EVENT_MESSAGE, "You cannot bet more than ", rules.maxBet, " chips at this table!"); }
+            else if (bet > chips) { out.say(EVENT_MESSAGE, "You only have ", chips, " chips!"); }
+        }
 
-    // Create a function that goes to all seats with players in them and bets placed, gives them a card
-    // The dealer gives a single card to the players from right to left before placing their own card face down.
-    boot.transferCard(yourHand);
-    boot.transferCard(dealerHand);
+        chips -= bet;
 
-    cout << "Your first card is " << yourHand[0] << endl;
-    this_thread::sleep_for(chrono::seconds(1));
+        // The dealer gives a single card to the player before placing their own card face down,
+        // then gives out a second card to the player and places their second card face up.
+        game.deal(bet);
 
-    cout << "The dealer receives a face down card" << endl;
-    this_thread::sleep_for(chrono::seconds(1));
+        out.say(EVENT_CARD, "Your first card is ", game.hand(0).cards[0]);
+        out.pause(1000);
 
-    cout << endl;
+        out.say(EVENT_CARD, "The dealer receives a face down card");
+        out.pause(1000);
 
-    // The dealer then gives out a second card to all players, and places their second card face up.
-    boot.transferCard(yourHand);
-    boot.transferCard(dealerHand);
+        out.gap();
 
-    cout << "Your second card is " << yourHand[1] << endl;
-    this_thread::sleep_for(chrono::seconds(1));
+        out.say(EVENT_CARD, "Your second card is ", game.hand(0).cards[1]);
+        out.pause(1000);
 
-    cout << "The dealer has " << dealerHand[1] << endl;
-    this_thread::sleep_for(chrono::seconds(1));
+        out.say(EVENT_CARD, "The dealer has ", game.upCard());
+        out.pause(1000);
 
-    cout << endl;
+        out.gap();
 
-    // If the dealer has an Ace, insurance can be placed by the players
-    if (dealerHand[1].value == 1) {
-        placeInsurance = true;
+        // If the dealer has an Ace, insurance can be placed by the players
+        if (game.getPhase() == Game::INSURANCE) {
+            int maxInsurance = min(bet / 2, chips);
 
-        cout << "UH OH!! Insurance time" << endl;
-        cout << "The dealer will now take insurance" << endl;
-        cin >> insurance;
+            out.say(EVENT_MESSAGE, "UH OH!! Insurance time");
+            out.say(EVENT_PROMPT, "The dealer will now take insurance. How much will you place? (0-", maxInsurance, ", or Help [-1])");
 
-        while ((insurance > bet) || (insurance < 0) && !(cin >> insurance)) {
-            // Clears the input buffer to prevent infinite loops
-            cin.clear();
-            cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            while (insurance < 0 || insurance > maxInsurance) {
+                // Without any more input, the player doesn't take insurance
+                if (!readNumber(out, insurance, -2)) { insurance = 0; }
 
-            // Let the player know what they did wrong
-            if (insurance > bet) { cout << "You can only place up to half of your original bet in insurance." << endl << endl; }
-            if (insurance < 0) {cout << "That is not a valid bet. Please try again." << endl << endl; }
+                // Let the player know what they did wrong
+                if (insurance == -1) {
+                    showInsuranceAdvice(out, game.insuranceOdds(), game.hand(0).value.blackjack(), rules);
+                    out.say(EVENT_PROMPT, "How much will you place? (0-", maxInsurance, ")");
+                }
+                else if (insurance > maxInsurance) {
+                    out.say(EVENT_MESSAGE, "You can only place up to half of your original bet in insurance.");
+                    out.gap();
+                }
+                else if (insurance < 0) {
+                    out.say(EVENT_MESSAGE, "That is not a valid bet. Please try again.");
+                    out.gap();
+                }
+            }
 
-            cin >> insurance;
-        }
-    }
+            chips -= insurance;
+            game.insure(insurance);
 
-    // Once insurance has been placed, the dealer will check the card. If they have blackjack, then those who placed insurance will receive 2:1 of their insurance bet. Otherwise, the bet is collected by the dealer and the game continues.
-    if (placeInsurance) {
-        if (dealerHand[0].value >= 10) {
-            cout << "The dealer has blackjack! Those who bet insurance will be paid." << endl;
-            chips += 2*insurance;
-            this_thread::sleep_for(chrono::seconds(1));
+            // Once insurance has been placed, the dealer will check the card. If they have blackjack, then those who
+            // placed insurance will receive 2:1 of their insurance bet. Otherwise, the bet is collected by the dealer.
+            if (game.getResult().dealerBlackjack) {
+                out.say(EVENT_CARD, "The dealer has blackjack! Those who bet insurance will be paid.");
+            }
+            else {
+                out.say(EVENT_CARD, "The dealer does not have blackjack. Insurance has been collected");
+            }
+            out.pause(1000);
         }
-        else {
-            cout << "The dealer does not have blackjack. Insurance has been collected" << endl;
-            chips -= insurance;
-            this_thread::sleep_for(chrono::seconds(1));
+        else if (game.getResult().dealerBlackjack) {
+            out.say(EVENT_CARD, "The dealer checks their face down card... The dealer has blackjack!");
+            out.pause(1000);
         }
-    }
 
-    total(yourHand);
+        total(out, game.hand(0).cards);
 
-    //yourTurn();
+        // Then the player decides what they will do with each of their hands
+        int playingHand = -1;
+        while (game.getPhase() == Game::PLAYER_TURN) {
+            int index = game.currentHand();
 
-    int action = -1;
-    bool endTurn = false, bust = false;
-    
-    while (!endTurn && !bust) {
-        // Perform an action on your turn
-        cout << "What will you do?" << endl;
-        cout << "Help [0], Hit [1], Stand [2], Double Down [3], Split [4], Count Chips [5]" << endl;
+            if (index != playingHand && game.handCount() > 1) {
+                out.gap();
+                out.say(EVENT_MESSAGE, "Playing hand ", index + 1, " of ", game.handCount(), ":");
+                for (const Card& card : game.hand().cards) { out.say(EVENT_CARD, "    ", card); }
+                total(out, game.hand().cards);
+            }
+            playingHand = index;
 
-        while ((action < 0) || (action > 5) && !(cin >> action)) {
-            cin >> action;
+            // Perform an action on your turn
+            int action = -1;
+            out.say(EVENT_PROMPT, "What will you do?");
+            out.say(EVENT_PROMPT, "Help [0], Hit [1], Stand [2], Double Down [3], Split [4], Count Chips [5]");
 
-            // Clears the input buffer to prevent infinite loops
-            cin.clear();
-            cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            while (action < 0 || action > 5) {
+                // Without any more input, the player stands on every hand left to finish the round
+                if (!readNumber(out, action, -1)) { action = STAND; }
 
-            if (action < 0 || action > 5) {
-                cout << "Invalid action. Please try again." << endl;
+                if (action < 0 || action > 5) {
+                    out.say(EVENT_MESSAGE, "Invalid action. Please try again.");
+                }
+            }
+
+            switch (action) {
+                case HELP:
+                    bookMove(out, game.hand().cards, game.dealerHand(), game.canDouble(), game.canSplit(), rules);
+                    showActionValues(out, calculator.evaluate(game));
+                    break;
+                case HIT:
+                case STAND:
+                    game.act((Action)action);
+                    if (action == HIT) { out.say(EVENT_CARD, "You draw ", game.hand(index).cards.back()); }
+                    total(out, game.hand(index).cards);
+                    break;
+                case DOUBLE:
+                    if (!game.canDouble()) {
+                        out.say(EVENT_MESSAGE, "You may only double down on your first two cards.");
+                    }
+                    else if (chips < game.hand().bet) {
+                        out.say(EVENT_MESSAGE, "You don't have enough chips to double down.");
+                    }
+                    else {
+                        chips -= game.hand().bet;
+                        game.act(DOUBLE);
+                        out.say(EVENT_CARD, "You draw ", game.hand(index).cards.back());
+                        total(out, game.hand(index).cards);
+                    }
+                    break;
+                case SPLIT:
+                    if (!game.canSplit()) {
+                        out.say(EVENT_MESSAGE, "You may only split when you have a pair.");
+                    } // Check if the cards match
+                    else if (chips < game.hand().bet) {
+                        out.say(EVENT_MESSAGE, "You don't have enough chips to split.");
+                    }
+                    else {
+                        out.say(EVENT_MESSAGE, "Splitting...");
+                        chips -= game.hand().bet;
+                        game.act(SPLIT);
+                        playingHand = -1;
+                    }
+                    break;
+                case 5:
+                    out.gap();
+                    out.say(EVENT_MESSAGE, "Counting...");
+                    out.pause(1000);
+                    out.say(EVENT_MESSAGE, "Chips remaining: ", chips);
+                    break;
             }
         }
 
-        switch (action) {
-            case 0: // Help
-                bookMove(yourHand, dealerHand);
-                break;
-            case 1: // Hit
-                boot.transferCard(yourHand);
-                bust = total(yourHand);
-                break;
-            case 2: // Stand
-                total(yourHand);
-                endTurn = true;
-                break;
-            case 3: // Double
-                boot.transferCard(yourHand);
-                bust = total(yourHand);
-                endTurn = true;
-                // End turn
-                break;
-            case 4: // Split
-                if (yourHand[0].value == yourHand[1].value) {
-                    cout << "Splitting..." << endl;
-                    vector<Card> temp;
+        // The dealer turns over their face down card and draws until they reach 17
+        const RoundResult& result = game.getResult();
+        const Hand& dealerHand = game.dealerHand();
 
-                    sendCard(yourHand, temp);
+        out.gap();
+        out.say(EVENT_CARD, "The dealer turns over ", dealerHand[0]);
+        out.pause(1000);
 
-                } // Check if the cards match
-                else {
-                    cout << "You may only split when you have a pair." << endl;
-                }
-                break;
-            case 5:
-                cout << endl << "Counting..." << endl;
-                this_thread::sleep_for(chrono::seconds(1));
-                cout << "Chips remaining: " << chips << endl;
-                break;
+        for (int i = 2; i < dealerHand.size(); i++) {
+            out.say(EVENT_CARD, "The dealer draws ", dealerHand[i]);
+            out.pause(1000);
         }
 
-        action = -1;
-    }
-    
-    if (bust) {
-        cout << "Busted :(" << endl;
-        bet = 0;
-    }
-    else {
-        cout << "didn't bust :)" << endl;
-        bet = 0;
-    }
-    
-    // If the player and dealer both have blackjack, then it is a push (a tie), and the player neither wins nor loses money on the hand.
-    // If the game has continued, any players that have blackjack will be paid out immediately.
-
-    // Then from right to left, the players can decide what they will do. 
+        out.say(EVENT_TOTAL, "The dealer has ", result.dealerTotal, (result.dealerTotal > 21 ? ", too many!" : ""));
+        out.gap();
 
+        for (int i = 0; i < game.handCount(); i++) {
+            showOutcome(out, game.hand(i), game.handCount(), i);
+        }
+        chips += result.returned;
 
+        // Collects all of the cards from the table, and shuffles the boot if it is time
+        game.endRound();
+        if (game.getResult().reshuffled) {
+            out.say(EVENT_SHUFFLE, "It is time for a new boot!");
+            out.say(EVENT_SHUFFLE, "The deck has been shuffled.");
+        }
 
-    // Collects all of the cards from the seats
-    sendAllCards(seats, discardPile);
-    
+        // An instrumented build rewrites its metrics after every round when asked to, for a scraper to pick up
+        if (metricsJson || metricsProm) {
+            dumpMetrics(metricsJson ? metricsJson : "", metricsProm ? metricsProm : "");
+        }
 
-    // Time to shuffle the boot!
-    if (discardPile.size() > 160) {
-        // Collect all cards from the table and shuffle
-        cout << "It is time for a new boot!" << endl;
-        boot.addCards(discardPile);
-        boot.shuffle();       
-    }
+        int response = 0;
 
-    // Check if the player has enough chips to play
-    if (chips < 5) {
-        int response;
-        cout << "You don't have enough chips to play! Game over." << endl << "Enter [1] to restart the game, or [2] to return to the menu." << endl;
-        cin >> response;
-        
-        while (!(cin >> response)) {
-            if (response == 1) {
-                playing = true;
-                cout << "Restarting the game." << endl;
-            } // Start the game over
-            else if (response == 2) {
-                cout << "Closing the game." << endl;
-                playing = false;
-            } // Close the game
-            
-            // Clear input buffer to prevent infinite loop
-            cin.clear();
-            cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        // Check if the player has enough chips to play
+        if (chips < rules.minBet) {
+            out.say(EVENT_PROMPT, "You don't have enough chips to play! Game over.");
+            out.say(EVENT_PROMPT, "Enter [1] to restart the game, or [2] to return to the menu.");
+        }
+        else {
+            out.gap();
+            out.say(EVENT_PROMPT, "Enter [1] to play another hand, or [2] to return to the menu.");
+        }
+        out.endRound();
 
-            cin >> response;
+        while (response != 1 && response != 2) {
+            // Give up if there is no more input to read
+            if (!readNumber(out, response, 0)) { response = 2; }
         }
+
+        if (response == 1 && chips < rules.minBet) {
+            out.say(EVENT_MESSAGE, "Restarting the game.");
+            chips = 20;
+        } // Start the game over
+        else if (response == 2) {
+            out.say(EVENT_MESSAGE, "Closing the game.");
+            out.endRound();
+            playing = false;
+        } // Close the game
     }
 
     return;
 }
 
-int main() {
+// Plays the console game with the output picked on the command line. --turbo drops the pauses and flushes once
+// a round, --quiet shows nothing at all, and --events writes every line to a log as JSON. --seed deals the same
+// cards every time, e.g. "blackjack play --turbo --seed 7 < moves.txt"
+bool playConsole(int argc, char* argv[]) {
+    uint64_t seed = argValue(argc, argv, "seed", chrono::system_clock::now().time_since_epoch().count());
+    string eventsPath = argText(argc, argv, "events", "");
+
+    TerminalSink terminal(cout, hasFlag(argc, argv, "turbo"));
+    NullSink quiet;
+    GameSink* out = hasFlag(argc, argv, "quiet") ? (GameSink*)&quiet : &terminal;
+
+    if (eventsPath.empty()) {
+        blackjack(*out, seed);
+        return true;
+    }
+
+    FILE* log = fopen(eventsPath.c_str(), "w");
+    if (!log) {
+        cout << "Could not open " << eventsPath << endl;
+        return false;
+    }
+
+    EventSink events(log, out);
+    blackjack(events, seed);
+    fclose(log);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
     /*
     Card card = Card(1, 3); // Creates an Ace of Diamonds
     Card card2 = Card(6, 1); // Creates a 6 of Clubs
@@ -599,7 +7668,61 @@ int main() {
     deck.showCards();
     */
 
-    blackjack();
+    // Headless modes are picked on the command line, e.g. "blackjack sim --hands 1000000"
+    if (argc > 1) {
+        string mode = argv[1];
+
+        if (mode == "sim") {
+            simulate(argc, argv);
+        }
+        else if (mode == "play") {
+            if (!playConsole(argc, argv)) { return 1; }
+        }
+        else if (mode == "odds") {
+            dealerOdds(argc, argv);
+        }
+        else if (mode == "strategy") {
+            if (!strategyChart(argc, argv)) { return 1; }
+        }
+        else if (mode == "bench") {
+            if (!benchmark(argc, argv)) { return 1; }
+        }
+        else if (mode == "batch") {
+            if (!batchSimulate(argc, argv)) { return 1; }
+        }
+        else if (mode == "merge") {
+            if (!mergeShards(argc, argv)) { return 1; }
+        }
+        else if (mode == "replay") {
+            if (!replayLog(argc, argv)) { return 1; }
+        }
+        else if (mode == "sweep") {
+            if (!ruleSweep(argc, argv)) { return 1; }
+        }
+        else if (mode == "serve") {
+            if (!runServer(argc, argv)) { return 1; }
+        }
+        else if (mode == "load") {
+            if (!loadTest(argc, argv)) { return 1; }
+        }
+        else {
+            cout << "Unknown mode " << mode << ". Available modes: play, sim, merge, sweep, batch, replay, odds, strategy, bench, serve, load" << endl;
+            return 1;
+        }
+
+        // Any mode can write the metrics of an instrumented build once it has finished
+        string metricsJson = argText(argc, argv, "metrics-json", ""), metricsProm = argText(argc, argv, "metrics-prom", "");
+        if (!metricsJson.empty() || !metricsProm.empty()) {
+            if (!dumpMetrics(metricsJson, metricsProm)) { return 1; }
+        }
+
+        return 0;
+    }
+
+    // The console game is paced for a person, and shows everything as it happens
+    TerminalSink terminal(cout);
+    uint64_t seed = chrono::system_clock::now().time_since_epoch().count();
+    blackjack(terminal, seed);
 
     int response = 0;
     bool start = false;
@@ -610,12 +7733,15 @@ int main() {
 
         cin >> response;
 
+        // Stop asking once there is no more input to read
+        if (!cin) { return 0; }
+
         if (response == 1) { start = true; }
     }
 
     switch (response) {
         case 1:
-            blackjack();
+            blackjack(terminal, seed + 1);
             break;
         default:
             cout << "Unknown game! Please try again" << endl;
@@ -623,4 +7749,4 @@ int main() {
     }
 
     return 0;
-}
\ No newline at end of file
+}